@@ -0,0 +1,361 @@
+/**
+ * Renders every subtitle stream of the files in a directory without playing the video, to compare
+ * subtitle rendering changes on real ASS and PGS files. Each stream is drawn at every frame size
+ * given, one frame every 1/24s from its first subtitle to its last, through the same calls the
+ * player makes: ASSRenderer::getBitmaps and the handler's blendToFrame. The text handler renders
+ * with libass inside blendToFrame, its render time is taken out of the blend time.
+ *
+ * Built when configured with -DVPLAYER_SUBTITLE_BENCHMARK=ON, run on the device next to
+ * libffmpeg.so:
+ *      LD_LIBRARY_PATH=. ./subtitle_benchmark /sdcard/subtitles 1280x720 1920x1080
+ */
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+#include <dirent.h>
+#include <malloc.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../player/ASSRenderer.h"
+#include "../player/SSAHandler.h"
+#include "../player/ImageSubHandler.h"
+#include "../player/SubtitleTrackCache.h"
+
+#define FRAMES_PER_SECOND 24
+
+// Frame sizes used when none are passed in
+#define DEFAULT_SIZES { {1280, 720}, {1920, 1080} }
+
+// Bytes requested from operator new by the whole process, libass and ffmpeg use malloc directly
+static std::atomic<size_t> sAllocatedBytes(0);
+
+void* operator new(size_t size) {
+    sAllocatedBytes += size;
+    void* ptr = malloc(size);
+    if (!ptr) {
+        abort();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+struct Size {
+    int width;
+    int height;
+};
+
+class Samples {
+public:
+    void add(int64_t timeUs) {
+        mTimesUs.push_back(timeUs);
+    }
+
+    size_t size() const {
+        return mTimesUs.size();
+    }
+
+    double percentileMs(double percent) {
+        if (mTimesUs.empty()) {
+            return 0;
+        }
+        std::sort(mTimesUs.begin(), mTimesUs.end());
+        size_t index = std::min(mTimesUs.size() - 1, (size_t) (mTimesUs.size() * percent / 100));
+        return mTimesUs[index] / 1000.0;
+    }
+
+private:
+    std::vector<int64_t> mTimesUs;
+};
+
+static const char* errorString(int errorCode) {
+    static char buffer[AV_ERROR_MAX_STRING_SIZE];
+    av_strerror(errorCode, buffer, sizeof(buffer));
+    return buffer;
+}
+
+static int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int openDecoder(const AVStream* stream, AVCodecContext** outContext) {
+    int ret;
+    AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec) {
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+    AVCodecContext* context = avcodec_alloc_context3(NULL);
+    if (!context) {
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = avcodec_parameters_to_context(context, stream->codecpar)) < 0) {
+        avcodec_free_context(&context);
+        return ret;
+    }
+    context->pkt_timebase = stream->time_base;
+    if ((ret = avcodec_open2(context, codec, NULL)) < 0) {
+        avcodec_free_context(&context);
+        return ret;
+    }
+    *outContext = context;
+    return 0;
+}
+
+static AVFrame* allocVideoFrame(const Size& size) {
+    AVFrame* frame = av_frame_alloc();
+    if (!frame) {
+        return NULL;
+    }
+    frame->format = AV_PIX_FMT_RGBA;
+    frame->width = size.width;
+    frame->height = size.height;
+    if (av_frame_get_buffer(frame, 32) < 0) {
+        av_frame_free(&frame);
+        return NULL;
+    }
+    memset(frame->data[0], 0, (size_t) frame->linesize[0] * frame->height);
+    return frame;
+}
+
+// Decode the packet and give the subtitle to the handler the way SubtitleStream does
+static void decodeToHandler(AVCodecContext* cContext, SubtitleStream::SubtitleHandlerBase* handler,
+                            AVPacket* pkt) {
+    int gotFrame = 0;
+    AVSubtitle* subtitle = handler->getSubtitle();
+    if (subtitle && avcodec_decode_subtitle2(cContext, subtitle, &gotFrame, pkt) >= 0 && gotFrame
+            && !handler->handleDecodedSubtitle(subtitle, 0)) {
+        avsubtitle_free(subtitle);
+    }
+}
+
+static void printResult(const char* name, int streamIndex, const char* type, const Size& size,
+                        Samples& render, Samples& blend, size_t allocatedBytes,
+                        long heapGrowth) {
+    const size_t frames = blend.size();
+    printf("%s #%d [%s] %dx%d: %zu frames", name, streamIndex, type, size.width, size.height,
+           frames);
+    if (render.size() > 0) {
+        printf(", render p50 %.3fms p99 %.3fms", render.percentileMs(50), render.percentileMs(99));
+    }
+    printf(", blend p50 %.3fms p99 %.3fms, new %zu B/frame, heap %+ldKB\n",
+           blend.percentileMs(50), blend.percentileMs(99),
+           frames > 0 ? allocatedBytes / frames : 0, heapGrowth / 1024);
+}
+
+static int benchmarkTextStream(const char* name, AVFormatContext* fContext, int streamIndex,
+                               std::vector<AVPacket>& packets, const Size& size) {
+    int ret;
+    AVCodecContext* cContext = NULL;
+    if ((ret = openDecoder(fContext->streams[streamIndex], &cContext)) < 0) {
+        return ret;
+    }
+    AVFrame* frame = allocVideoFrame(size);
+    if (!frame) {
+        avcodec_free_context(&cContext);
+        return AVERROR(ENOMEM);
+    }
+    const long heapStart = mallinfo().uordblks;
+    {
+        SubtitleTrackCache trackCache(fContext);
+        SSAHandler handler(cContext->codec_id, &trackCache);
+        if ((ret = handler.open(cContext, fContext, streamIndex)) >= 0) {
+            for (AVPacket& pkt : packets) {
+                if (pkt.stream_index == streamIndex) {
+                    decodeToHandler(cContext, &handler, &pkt);
+                }
+            }
+
+            // Second renderer over the same track to time libass on its own
+            ASS_Track* track = trackCache.attach(streamIndex, cContext, NULL);
+            long long start = LLONG_MAX, end = 0;
+            for (int i = 0; i < track->n_events; i++) {
+                start = std::min(start, track->events[i].Start);
+                end = std::max(end, track->events[i].Start + track->events[i].Duration);
+            }
+            ASSRenderer renderer;
+            renderer.setSize(size.width, size.height);
+
+            Samples render, blend;
+            size_t allocatedBytes = 0;
+            std::vector<SubtitleFrameQueue::Rect> dirtyRects;
+            SubtitleFrameQueue::Rect damage;
+            for (long long time = start; time <= end; time += 1000 / FRAMES_PER_SECOND) {
+                int numBitmaps, changed;
+                const size_t allocated = sAllocatedBytes;
+                int64_t startUs = nowUs();
+                renderer.getBitmaps(track, time, &numBitmaps, &changed);
+                render.add(nowUs() - startUs);
+
+                // SSA handler reads the time from the video frame in milliseconds
+                frame->pts = time;
+                dirtyRects.clear();
+                const int64_t handlerRenderUs = handler.getRendererStats().renderTimeUs;
+                startUs = nowUs();
+                handler.blendToFrame(time / 1000.0, frame, 0, false, &dirtyRects, &damage);
+                const int64_t handlerUs = nowUs() - startUs;
+                blend.add(handlerUs - (handler.getRendererStats().renderTimeUs - handlerRenderUs));
+                allocatedBytes += sAllocatedBytes - allocated;
+            }
+            printResult(name, streamIndex, "text", size, render, blend, allocatedBytes,
+                        mallinfo().uordblks - heapStart);
+        }
+    }
+    av_frame_free(&frame);
+    avcodec_free_context(&cContext);
+    return ret;
+}
+
+static int benchmarkImageStream(const char* name, AVFormatContext* fContext, int streamIndex,
+                                std::vector<AVPacket>& packets, const Size& size) {
+    int ret;
+    const AVStream* stream = fContext->streams[streamIndex];
+    AVCodecContext* cContext = NULL;
+    if ((ret = openDecoder(stream, &cContext)) < 0) {
+        return ret;
+    }
+    AVFrame* frame = allocVideoFrame(size);
+    if (!frame) {
+        avcodec_free_context(&cContext);
+        return AVERROR(ENOMEM);
+    }
+
+    std::vector<AVPacket*> streamPackets;
+    for (AVPacket& pkt : packets) {
+        if (pkt.stream_index == streamIndex && pkt.pts != AV_NOPTS_VALUE) {
+            streamPackets.push_back(&pkt);
+        }
+    }
+    const long heapStart = mallinfo().uordblks;
+    {
+        ImageSubHandler handler(cContext->codec_id);
+        if (!streamPackets.empty() && (ret = handler.open(cContext, fContext, streamIndex)) >= 0) {
+            const double start = streamPackets.front()->pts * av_q2d(stream->time_base);
+            const double end = streamPackets.back()->pts * av_q2d(stream->time_base);
+
+            Samples render, blend;
+            size_t allocatedBytes = 0, next = 0;
+            std::vector<SubtitleFrameQueue::Rect> dirtyRects;
+            SubtitleFrameQueue::Rect damage;
+            for (double time = start; time <= end; time += 1.0 / FRAMES_PER_SECOND) {
+                // Decode only what is due, the handler's queue blocks once it is full
+                while (next < streamPackets.size()
+                        && streamPackets[next]->pts * av_q2d(stream->time_base) <= time) {
+                    decodeToHandler(cContext, &handler, streamPackets[next++]);
+                }
+
+                const size_t allocated = sAllocatedBytes;
+                dirtyRects.clear();
+                const int64_t startUs = nowUs();
+                handler.blendToFrame(time, frame, 0, false, &dirtyRects, &damage);
+                blend.add(nowUs() - startUs);
+                allocatedBytes += sAllocatedBytes - allocated;
+            }
+            printResult(name, streamIndex, "image", size, render, blend, allocatedBytes,
+                        mallinfo().uordblks - heapStart);
+        }
+    }
+    av_frame_free(&frame);
+    avcodec_free_context(&cContext);
+    return ret;
+}
+
+static int benchmarkFile(const std::string& path, const char* name,
+                         const std::vector<Size>& sizes) {
+    int ret;
+    AVFormatContext* fContext = NULL;
+    if ((ret = avformat_open_input(&fContext, path.c_str(), NULL, NULL)) < 0) {
+        return ret;
+    }
+    if ((ret = avformat_find_stream_info(fContext, NULL)) < 0) {
+        avformat_close_input(&fContext);
+        return ret;
+    }
+
+    // Read the subtitle packets once, every stream and size is benchmarked from memory
+    std::vector<AVPacket> packets;
+    AVPacket pkt;
+    while (av_read_frame(fContext, &pkt) >= 0) {
+        if (fContext->streams[pkt.stream_index]->codecpar->codec_type == AVMEDIA_TYPE_SUBTITLE) {
+            packets.push_back(pkt);
+        } else {
+            av_packet_unref(&pkt);
+        }
+    }
+
+    for (int i = 0; i < fContext->nb_streams; i++) {
+        const AVCodecParameters* params = fContext->streams[i]->codecpar;
+        if (params->codec_type != AVMEDIA_TYPE_SUBTITLE) {
+            continue;
+        }
+        for (const Size& size : sizes) {
+            ret = SubtitleTrackCache::isTextSub(params->codec_id)
+                  ? benchmarkTextStream(name, fContext, i, packets, size)
+                  : benchmarkImageStream(name, fContext, i, packets, size);
+            if (ret < 0) {
+                fprintf(stderr, "%s #%d: cannot benchmark stream (%s)\n", name, i,
+                        errorString(ret));
+                break;
+            }
+        }
+    }
+
+    for (AVPacket& p : packets) {
+        av_packet_unref(&p);
+    }
+    avformat_close_input(&fContext);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <directory> [WIDTHxHEIGHT...]\n", argv[0]);
+        return 1;
+    }
+    std::vector<Size> sizes;
+    for (int i = 2; i < argc; i++) {
+        Size size;
+        if (sscanf(argv[i], "%dx%d", &size.width, &size.height) != 2 || size.width <= 0
+                || size.height <= 0) {
+            fprintf(stderr, "Invalid frame size: %s\n", argv[i]);
+            return 1;
+        }
+        sizes.push_back(size);
+    }
+    if (sizes.empty()) {
+        sizes = DEFAULT_SIZES;
+    }
+
+    DIR* dir = opendir(argv[1]);
+    if (!dir) {
+        fprintf(stderr, "Cannot open directory: %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<std::string> names;
+    for (struct dirent* entry; (entry = readdir(dir)) != NULL;) {
+        if (entry->d_name[0] != '.' && entry->d_type != DT_DIR) {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    av_log_set_level(AV_LOG_ERROR);
+    for (const std::string& name : names) {
+        int ret = benchmarkFile(std::string(argv[1]) + "/" + name, name.c_str(), sizes);
+        if (ret < 0) {
+            fprintf(stderr, "%s: cannot open (%s)\n", name.c_str(), errorString(ret));
+        }
+    }
+    return 0;
+}
@@ -1,5 +1,51 @@
 #include "ASSBitmap.h"
 #include <cmath>
+#include <cstring>
+
+#define HASH_PRIME1 0x9e3779b185ebca87ULL
+#define HASH_PRIME2 0xc2b2ae3d27d4eb4fULL
+#define HASH_PRIME3 0x165667b19e3779f9ULL
+
+static inline uint64_t hashCombine(uint64_t hash, uint64_t value) {
+    return hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+}
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hashRound(uint64_t acc, uint64_t input) {
+    acc += input * HASH_PRIME2;
+    return rotl64(acc, 31) * HASH_PRIME1;
+}
+
+// xxHash64 style hash of the visible pixels of an image, stride padding is ignored
+static uint64_t hashImageContent(const ASS_Image* image) {
+    uint64_t hash = HASH_PRIME3 + ((uint64_t) image->w << 32 | (uint32_t) image->h);
+    const auto width = (size_t) image->w;
+    const unsigned char* row = image->bitmap;
+    for (int y = 0; y < image->h; ++y, row += image->stride) {
+        size_t x = 0;
+        for (; x + 8 <= width; x += 8) {
+            uint64_t v;
+            memcpy(&v, row + x, sizeof(v));
+            hash = hashRound(hash, v);
+        }
+        uint64_t tail = 0;
+        for (; x < width; ++x) {
+            tail = (tail << 8) | row[x];
+        }
+        hash = hashRound(hash, tail);
+    }
+
+    // Avalanche
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME3;
+    hash ^= hash >> 32;
+    return hash != 0 ? hash : 1;
+}
 
 ASSBitmap::ASSBitmap() :
         buffer(nullptr),
@@ -11,7 +57,8 @@ ASSBitmap::ASSBitmap() :
         x1(0),
         x2(0),
         y1(0),
-        y2(0) {
+        y2(0),
+        key(0) {
 }
 
 ASSBitmap::~ASSBitmap() {
@@ -31,6 +78,7 @@ void ASSBitmap::clear() {
     x2 = 0;
     y1 = 0;
     y2 = 0;
+    key = 0;
 }
 
 bool ASSBitmap::overlaps(ASS_Image *image) {
@@ -38,7 +86,7 @@ bool ASSBitmap::overlaps(ASS_Image *image) {
         y1 < (image->dst_y + image->h) && y2 > image->dst_y;
 }
 
-void ASSBitmap::add(ASS_Image *image) {
+void ASSBitmap::add(ASS_Image *image, bool hashContent) {
     if (numOfImages == 0) {
         // If no images, bounding box is first image
         x1 = image->dst_x;
@@ -56,6 +104,7 @@ void ASSBitmap::add(ASS_Image *image) {
 
     if (mImages.size() < numOfImages) {
         mImages.emplace_back(ASS_Image());
+        mImageHashes.push_back(0);
     }
 
     // Copy the data into image buffer
@@ -69,6 +118,17 @@ void ASSBitmap::add(ASS_Image *image) {
     mImages[numOfImages - 1].next = image->next;
     mImages[numOfImages - 1].type = image->type;
     changed = true;
+
+    const uint64_t contentHash = hashContent ? hashImageContent(image) : 0;
+    mImageHashes[numOfImages - 1] = contentHash;
+
+    // Same fields compare() checks so equal or moved bitmaps land in the same hash bucket
+    key = hashCombine(key, (uint64_t) (image->dst_x - mImages[0].dst_x));
+    key = hashCombine(key, (uint64_t) (image->dst_y - mImages[0].dst_y));
+    key = hashCombine(key, (uint64_t) image->w);
+    key = hashCombine(key, (uint64_t) image->h);
+    key = hashCombine(key, (uint64_t) image->color);
+    key = hashCombine(key, contentHash ? contentHash : (uint64_t) (uintptr_t) image->bitmap);
 }
 
 void ASSBitmap::flattenImage() {
@@ -102,18 +162,21 @@ void ASSBitmap::flattenImage() {
     }
 }
 
-static int ass_image_compare(ASS_Image *i1, ASS_Image *i2)
+static int ass_image_compare(ASS_Image *i1, ASS_Image *i2, uint64_t hash1, uint64_t hash2)
 {
     if (i1->w != i2->w)
         return 2;
     if (i1->h != i2->h)
         return 2;
-    if (i1->stride != i2->stride)
-        return 2;
     if (i1->color != i2->color)
         return 2;
-    if (i1->bitmap != i2->bitmap)
+    if (hash1 && hash2) {
+        // Content was hashed, same pixels may have been rendered into new memory
+        if (hash1 != hash2)
+            return 2;
+    } else if (i1->stride != i2->stride || i1->bitmap != i2->bitmap) {
         return 2;
+    }
     if (i1->dst_x != i2->dst_x)
         return 1;
     if (i1->dst_y != i2->dst_y)
@@ -122,19 +185,28 @@ static int ass_image_compare(ASS_Image *i1, ASS_Image *i2)
 }
 
 int ASSBitmap::compare(ASSBitmap *bitmap) {
-    if (numOfImages != bitmap->numOfImages || x1 != bitmap->x1 || x2 != bitmap->x2
-            || y1 != bitmap->y1 || y2 != bitmap->y2) {
+    if (numOfImages != bitmap->numOfImages || x2 - x1 != bitmap->x2 - bitmap->x1
+            || y2 - y1 != bitmap->y2 - bitmap->y1) {
         return 2;
     }
-    int ret = 0;
+    const int dx = bitmap->x1 - x1;
+    const int dy = bitmap->y1 - y1;
     for (size_t i = 0; i < numOfImages; ++i) {
-        int result = ass_image_compare(&mImages[i], &bitmap->mImages[i]);
-        if (result >= 2) {
-            return result;
+        ASS_Image& image = mImages[i];
+        ASS_Image& other = bitmap->mImages[i];
+        if (ass_image_compare(&image, &other, mImageHashes[i], bitmap->mImageHashes[i]) >= 2
+                || other.dst_x - image.dst_x != dx || other.dst_y - image.dst_y != dy) {
+            return 2;
         }
-        ret = std::max(result, ret);
     }
-    return ret;
+    return dx != 0 || dy != 0 ? 1 : 0;
+}
+
+void ASSBitmap::swapBuffer(ASSBitmap *bitmap) {
+    std::swap(buffer, bitmap->buffer);
+    std::swap(size, bitmap->size);
+    std::swap(stride, bitmap->stride);
+    std::swap(mBufferCapacity, bitmap->mBufferCapacity);
 }
 
 void ASSBitmap::blendSubtitle(uint8_t *buffer, size_t stride, ASS_Image *srcImage) {
@@ -13,12 +13,28 @@ public:
 
     bool overlaps(ASS_Image* image);
 
-    void add(ASS_Image* image);
+    /**
+     * Add an image to this bitmap
+     * @param hashContent hash the pixels of the image so images libass rendered again into new
+     *                    memory still compare as unchanged
+     */
+    void add(ASS_Image* image, bool hashContent = false);
 
     void flattenImage();
 
+    /**
+     * Compare the images with another bitmap
+     * @return 0 if the same, 1 if the same but moved and 2 if the images changed
+     */
     int compare(ASSBitmap* bitmap);
 
+    // Take the flattened buffer of a bitmap with the same images, gives this buffer to it
+    void swapBuffer(ASSBitmap* bitmap);
+
+    // Hash of the images added relative to the first image, bitmaps that compare equal or only
+    // moved have the same key
+    uint64_t key;
+
     static void blendSubtitle(uint8_t * buffer, size_t stride, ASS_Image *srcImage);
 
     uint8_t* buffer;
@@ -34,6 +50,9 @@ public:
     std::vector<ASS_Image> mImages;
 private:
     size_t mBufferCapacity;
+
+    // Content hash of each image, 0 if not hashed
+    std::vector<uint64_t> mImageHashes;
 };
 
 #endif //BITMAP_SECTION_H
@@ -0,0 +1,169 @@
+#include "ASSLibraryCache.h"
+#include <android/log.h>
+#include <libavutil/error.h>
+
+#define MAX_IDLE_RENDERERS 2
+
+// Fonts from every opened file stay in the library, start over once nothing is rendering
+#define MAX_LIBRARY_FONT_BYTES (64 * 1024 * 1024)
+
+static const char *sTag = "ASSLibraryCache";
+
+static void ass_log(int ass_level, const char *fmt, va_list args, void *ctx) {
+//    __android_log_print(ANDROID_LOG_VERBOSE, sTag, fmt, args);
+}
+
+// FNV-1a of the font data, only used to skip registering the same font twice
+static uint64_t hashFontData(const char* data, int size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < size; i++) {
+        hash = (hash ^ (uint8_t) data[i]) * 0x100000001b3ULL;
+    }
+    return hash ^ (uint64_t) size;
+}
+
+ASSLibraryCache& ASSLibraryCache::get() {
+    // Never destroyed, renderers may still be released while the process exits
+    static ASSLibraryCache* sInstance = new ASSLibraryCache();
+    return *sInstance;
+}
+
+ASSLibraryCache::ASSLibraryCache() :
+        mLibrary(nullptr),
+        mFontBytes(0),
+        mFontGeneration(0),
+        mActiveRenderers(0) {
+    mLibrary = ass_library_init();
+    if (!mLibrary) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot allocate ass library");
+        return;
+    }
+    ass_set_message_cb(mLibrary, ass_log, nullptr);
+    ass_set_extract_fonts(mLibrary, true);
+}
+
+ASSLibraryCache::~ASSLibraryCache() {
+    for (RendererEntry& entry : mIdleRenderers) {
+        ass_renderer_done(entry.renderer);
+    }
+    mIdleRenderers.clear();
+    if (mLibrary) {
+        ass_library_done(mLibrary);
+        mLibrary = nullptr;
+    }
+}
+
+int ASSLibraryCache::acquireRenderer(RendererEntry *outEntry) {
+    if (!mLibrary) {
+        return AVERROR(ENOMEM);
+    }
+    bool reused = false;
+    {
+        std::lock_guard<std::mutex> lk(mMutex);
+        mActiveRenderers++;
+        if (!mIdleRenderers.empty()) {
+            *outEntry = mIdleRenderers.back();
+            mIdleRenderers.pop_back();
+            reused = true;
+        }
+    }
+    if (reused) {
+        resetRenderer(outEntry);
+        return 0;
+    }
+
+    // Creating the font provider is slow, do not block other renderers meanwhile
+    ASS_Renderer* renderer = ass_renderer_init(mLibrary);
+    if (!renderer) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot allocate ass renderer");
+        std::lock_guard<std::mutex> lk(mMutex);
+        mActiveRenderers--;
+        return AVERROR(ENOMEM);
+    }
+    const unsigned long generation = fontGeneration();
+    {
+        std::shared_lock<std::shared_timed_mutex> lk(mLibraryLock);
+        ass_set_fonts(renderer, nullptr, nullptr, ASS_FONTPROVIDER_AUTODETECT, nullptr, 1);
+    }
+    outEntry->renderer = renderer;
+    outEntry->fontGeneration = generation;
+    outEntry->defaultFontPath.clear();
+    outEntry->defaultFontName.clear();
+    return 0;
+}
+
+void ASSLibraryCache::resetRenderer(RendererEntry *entry) {
+    // Settings of the last user must not leak into the next one, sizes are set before rendering
+    ass_set_frame_size(entry->renderer, 0, 0);
+    ass_set_storage_size(entry->renderer, 0, 0);
+    ass_set_cache_limits(entry->renderer, 0, 0);
+
+    // Only a provider built with another default font or older fonts needs rebuilding
+    const unsigned long generation = fontGeneration();
+    if (entry->defaultFontPath.empty() && entry->defaultFontName.empty()
+            && entry->fontGeneration == generation) {
+        return;
+    }
+    {
+        std::shared_lock<std::shared_timed_mutex> lk(mLibraryLock);
+        ass_set_fonts(entry->renderer, nullptr, nullptr, ASS_FONTPROVIDER_AUTODETECT, nullptr, 1);
+    }
+    entry->fontGeneration = generation;
+    entry->defaultFontPath.clear();
+    entry->defaultFontName.clear();
+}
+
+void ASSLibraryCache::releaseRenderer(const RendererEntry &entry) {
+    std::lock_guard<std::mutex> lk(mMutex);
+    mActiveRenderers--;
+    if (mIdleRenderers.size() < MAX_IDLE_RENDERERS) {
+        mIdleRenderers.push_back(entry);
+    } else {
+        ass_renderer_done(entry.renderer);
+    }
+    clearFontsIfIdle();
+}
+
+bool ASSLibraryCache::addFont(char *name, char *data, int size) {
+    if (!mLibrary) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mMutex);
+        if (!mFontHashes.insert(hashFontData(data, size)).second) {
+            return false;
+        }
+        mFontBytes += size;
+        mFontGeneration++;
+    }
+    ass_add_font(mLibrary, name, data, size);
+    return true;
+}
+
+unsigned long ASSLibraryCache::fontGeneration() {
+    std::lock_guard<std::mutex> lk(mMutex);
+    return mFontGeneration;
+}
+
+void ASSLibraryCache::clearFontsIfIdle() {
+    if (mActiveRenderers > 0 || mFontBytes <= MAX_LIBRARY_FONT_BYTES) {
+        return;
+    }
+    std::unique_lock<std::shared_timed_mutex> lk(mLibraryLock, std::try_to_lock);
+    if (!lk.owns_lock()) {
+        // A track is still being created, try again next release
+        return;
+    }
+    __android_log_print(ANDROID_LOG_VERBOSE, sTag, "Clearing %d fonts from library",
+                        (int) mFontHashes.size());
+
+    // Font providers refer to the library's fonts, they cannot outlive them
+    for (RendererEntry& entry : mIdleRenderers) {
+        ass_renderer_done(entry.renderer);
+    }
+    mIdleRenderers.clear();
+    ass_clear_fonts(mLibrary);
+    mFontHashes.clear();
+    mFontBytes = 0;
+    mFontGeneration++;
+}
@@ -0,0 +1,77 @@
+#ifndef VPLAYER_LIB2_ASSLIBRARYCACHE_H
+#define VPLAYER_LIB2_ASSLIBRARYCACHE_H
+
+#include <ass/ass.h>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Process wide libass library shared by every ASSRenderer. Renderers that are released keep their
+ * font provider and are handed to the next renderer, so fontconfig autodetection and parsing the
+ * fonts only happen again when fonts were added or a default font was set.
+ * Anything reading the library (rendering, setting fonts) must hold the shared lock, anything
+ * adding fonts to it (adding fonts, creating tracks with embedded fonts) the exclusive lock.
+ */
+class ASSLibraryCache {
+public:
+    struct RendererEntry {
+        ASS_Renderer* renderer;
+        // Font generation and default font the renderer's font provider was built with
+        unsigned long fontGeneration;
+        std::string defaultFontPath;
+        std::string defaultFontName;
+    };
+
+    static ASSLibraryCache& get();
+
+    /**
+     * Get an idle renderer or create a new one with the autodetected font provider. Idle renderers
+     * are reset to no frame or storage size, default cache sizes and no default font.
+     * @param outEntry filled with the renderer and how its fonts were set up
+     * @return 0 if successful, negative error if the library or renderer cannot be allocated
+     */
+    int acquireRenderer(RendererEntry* outEntry);
+
+    // Give the renderer back to be reused, the caller must not use it anymore
+    void releaseRenderer(const RendererEntry& entry);
+
+    /**
+     * Add a font to the library if the same data was not added before, needs the exclusive lock
+     * @return true if the font is new
+     */
+    bool addFont(char* name, char* data, int size);
+
+    // Changes every time fonts are added or cleared from the library
+    unsigned long fontGeneration();
+
+    ASS_Library* library() {
+        return mLibrary;
+    }
+
+    std::shared_timed_mutex& lock() {
+        return mLibraryLock;
+    }
+
+private:
+    ASSLibraryCache();
+    ~ASSLibraryCache();
+
+    void resetRenderer(RendererEntry* entry);
+    void clearFontsIfIdle();
+
+    ASS_Library* mLibrary;
+    std::shared_timed_mutex mLibraryLock;
+
+    // Guards the fields below
+    std::mutex mMutex;
+    std::vector<RendererEntry> mIdleRenderers;
+    std::unordered_set<uint64_t> mFontHashes;
+    size_t mFontBytes;
+    unsigned long mFontGeneration;
+    int mActiveRenderers;
+};
+
+#endif //VPLAYER_LIB2_ASSLIBRARYCACHE_H
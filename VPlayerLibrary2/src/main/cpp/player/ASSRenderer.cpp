@@ -1,56 +1,59 @@
 #include "ASSRenderer.h"
+#include <algorithm>
+#include <chrono>
 #include <android/log.h>
 #include <libavutil/error.h>
 
 #define DEFAULT_BUFFER_SIZE 3
 
-static const char *sTag = "ASSRenderer";
+// Part of the cache budget for glyph outlines, the rest is for rendered bitmaps
+#define GLYPH_CACHE_BUDGET_PERCENT 25
 
-static void ass_log(int ass_level, const char *fmt, va_list args, void *ctx) {
-//    __android_log_print(ANDROID_LOG_VERBOSE, sTag, fmt, args);
-}
+// Rough size of a cached glyph outline, libass limits the glyph cache by count and not by size
+#define GLYPH_CACHE_ENTRY_BYTES (4 * 1024)
+
+static const char *sTag = "ASSRenderer";
 
 ASSRenderer::ASSRenderer() :
         mError(0),
+        mContentHashEnabled(true),
         mAssLibrary(nullptr),
         mAssRenderer(nullptr),
+        mFontGeneration(0),
         mBitmapBuffer(nullptr),
         mBitmapCount(0),
         mBitmapCapacity(0),
         mTmpBitmapBuffer(nullptr),
         mTmpBitmapCount(0),
         mTmpBitmapCapacity(0),
-        mDefaultFontPath(nullptr),
-        mDefaultFontPathCapacity(0),
-        mDefaultFontName(nullptr),
-        mDefaultFontNameCapacity(0) {
-    mAssLibrary = ass_library_init();
-    if (!mAssLibrary) {
-        __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot allocate ass library");
-        mError = AVERROR(ENOMEM);
+        mStats() {
+    ASSLibraryCache::RendererEntry entry;
+    if ((mError = ASSLibraryCache::get().acquireRenderer(&entry)) < 0) {
         return;
     }
-    ass_set_message_cb(mAssLibrary, ass_log, nullptr);
-    ass_set_extract_fonts(mAssLibrary, true);
-
-    mAssRenderer = ass_renderer_init(mAssLibrary);
-    if (!mAssRenderer) {
-        __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot allocate ass renderer");
-        mError = AVERROR(ENOMEM);
-        return;
-    }
-    ass_set_fonts(mAssRenderer, nullptr, nullptr, ASS_FONTPROVIDER_AUTODETECT, nullptr, 1);
+    mAssLibrary = ASSLibraryCache::get().library();
+    mAssRenderer = entry.renderer;
+    mFontGeneration = entry.fontGeneration;
+    mDefaultFontPath = entry.defaultFontPath;
+    mDefaultFontName = entry.defaultFontName;
 }
 
 ASSRenderer::~ASSRenderer() {
+    if (mStats.frames > 0) {
+        __android_log_print(ANDROID_LOG_VERBOSE, sTag,
+                            "Rendered %lu frames (%lu changed), avg %.2fms max %.2fms, "
+                            "reused %lu/%lu images, prerendered %lu frames in %.2fms",
+                            mStats.frames, mStats.changedFrames,
+                            mStats.renderTimeUs / 1000.0 / mStats.frames,
+                            mStats.maxRenderTimeUs / 1000.0, mStats.reusedImages, mStats.images,
+                            mStats.prerenderedFrames, mStats.prerenderTimeUs / 1000.0);
+    }
     if (mAssRenderer) {
-        ass_renderer_done(mAssRenderer);
+        ASSLibraryCache::get().releaseRenderer({mAssRenderer, mFontGeneration, mDefaultFontPath,
+                                                mDefaultFontName});
         mAssRenderer = nullptr;
     }
-    if (mAssLibrary) {
-        ass_library_done(mAssLibrary);
-        mAssLibrary = nullptr;
-    }
+    mAssLibrary = nullptr;
     if (mBitmapBuffer) {
         for (int i = 0; i < mBitmapCapacity; ++i) {
             delete mBitmapBuffer[i];
@@ -65,14 +68,6 @@ ASSRenderer::~ASSRenderer() {
         delete[] mTmpBitmapBuffer;
         mTmpBitmapBuffer = nullptr;
     }
-    if (mDefaultFontPath) {
-        delete[] mDefaultFontPath;
-        mDefaultFontPath = nullptr;
-    }
-    if (mDefaultFontName) {
-        delete[] mDefaultFontName;
-        mDefaultFontName = nullptr;
-    }
 }
 
 void ASSRenderer::setSize(int width, int height) {
@@ -83,35 +78,53 @@ void ASSRenderer::setSize(int width, int height) {
 
 void ASSRenderer::setDefaultFont(const char *fontPath, const char *fontFamilyName) {
     if (mAssRenderer) {
-        size_t size = strlen(fontPath) + 1;
-        if (mDefaultFontPath == nullptr || size > mDefaultFontPathCapacity) {
-            delete[] mDefaultFontPath;
-            mDefaultFontPath = new char[size];
-            strncpy(mDefaultFontPath, fontPath, size);
-            mDefaultFontPathCapacity = size;
-        }
-        size = strlen(fontFamilyName) + 1;
-        if (mDefaultFontName == nullptr || size > mDefaultFontNameCapacity) {
-            delete[] mDefaultFontName;
-            mDefaultFontName = new char[size];
-            strncpy(mDefaultFontName, fontFamilyName, size);
-            mDefaultFontNameCapacity = size;
+        // Reused renderers may already be set up with this font
+        if (mDefaultFontPath == fontPath && mDefaultFontName == fontFamilyName
+                && mFontGeneration == ASSLibraryCache::get().fontGeneration()) {
+            return;
         }
-        ass_set_fonts(mAssRenderer, mDefaultFontPath, mDefaultFontName, ASS_FONTPROVIDER_AUTODETECT,
-                      nullptr, 1);
+        mDefaultFontPath = fontPath;
+        mDefaultFontName = fontFamilyName;
+        applyFonts();
     }
 }
 
-void ASSRenderer::addFont(char *name, char *data, int size) {
+void ASSRenderer::addFont(char *name, char *data, int size, bool updateFonts) {
     if (mAssLibrary) {
-        ass_add_font(mAssLibrary, name, data, size);
-        ass_set_fonts(mAssRenderer, mDefaultFontPath, mDefaultFontName, ASS_FONTPROVIDER_AUTODETECT,
-                      nullptr, 1);
+        {
+            std::unique_lock<std::shared_timed_mutex> lk(ASSLibraryCache::get().lock());
+
+            // Releases often attach the same font under different names and previously opened
+            // files may have added it already
+            if (!ASSLibraryCache::get().addFont(name, data, size)) {
+                __android_log_print(ANDROID_LOG_VERBOSE, sTag, "Skipping known font: %s", name);
+            }
+        }
+        if (updateFonts) {
+            this->updateFonts();
+        }
+    }
+}
+
+void ASSRenderer::updateFonts() {
+    // Every call reparses all registered fonts, so only do it once after a batch of fonts
+    if (mAssRenderer && mFontGeneration != ASSLibraryCache::get().fontGeneration()) {
+        applyFonts();
     }
 }
 
+void ASSRenderer::applyFonts() {
+    std::shared_lock<std::shared_timed_mutex> lk(ASSLibraryCache::get().lock());
+    mFontGeneration = ASSLibraryCache::get().fontGeneration();
+    ass_set_fonts(mAssRenderer, mDefaultFontPath.empty() ? nullptr : mDefaultFontPath.c_str(),
+                  mDefaultFontName.empty() ? nullptr : mDefaultFontName.c_str(),
+                  ASS_FONTPROVIDER_AUTODETECT, nullptr, 1);
+}
+
 ASS_Track *ASSRenderer::createTrack(const char *data, int size) {
     if (mAssLibrary) {
+        // Embedded fonts in the header are extracted into the shared library
+        std::unique_lock<std::shared_timed_mutex> lk(ASSLibraryCache::get().lock());
         ASS_Track *track = ass_new_track(mAssLibrary);
         if (track) {
             if (data) {
@@ -125,7 +138,85 @@ ASS_Track *ASSRenderer::createTrack(const char *data, int size) {
 }
 
 ASS_Image *ASSRenderer::renderFrame(ASS_Track *track, long long time, int *changed) {
-    return ass_render_frame(mAssRenderer, track, time, changed);
+    return render(track, time, changed, false);
+}
+
+void ASSRenderer::prerenderFrame(ASS_Track *track, long long time) {
+    int changed = 0;
+    render(track, time, &changed, true);
+}
+
+ASS_Image *ASSRenderer::render(ASS_Track *track, long long time, int *changed, bool prerender) {
+    ASS_Image* images;
+    const auto start = std::chrono::steady_clock::now();
+    {
+        std::shared_lock<std::shared_timed_mutex> lk(ASSLibraryCache::get().lock());
+        images = ass_render_frame(mAssRenderer, track, time, changed);
+    }
+    const int64_t renderTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    updateStats(images, changed ? *changed : 2, renderTimeUs, prerender);
+    return images;
+}
+
+void ASSRenderer::setContentHashEnabled(bool enabled) {
+    mContentHashEnabled = enabled;
+}
+
+void ASSRenderer::setCacheBudget(int megabytes) {
+    if (!mAssRenderer) {
+        return;
+    }
+    if (megabytes <= 0) {
+        ass_set_cache_limits(mAssRenderer, 0, 0);
+        return;
+    }
+    const int64_t glyphBytes = (int64_t) megabytes * 1024 * 1024 / 100 * GLYPH_CACHE_BUDGET_PERCENT;
+    const int glyphMax = std::max((int) (glyphBytes / GLYPH_CACHE_ENTRY_BYTES), 1);
+    const int bitmapMegabytes = std::max(megabytes * (100 - GLYPH_CACHE_BUDGET_PERCENT) / 100, 1);
+    ass_set_cache_limits(mAssRenderer, glyphMax, bitmapMegabytes);
+}
+
+ASSRenderer::Stats ASSRenderer::getStats() {
+    std::lock_guard<std::mutex> lk(mStatsMutex);
+    return mStats;
+}
+
+void ASSRenderer::resetStats() {
+    std::lock_guard<std::mutex> lk(mStatsMutex);
+    mStats = Stats();
+}
+
+void ASSRenderer::updateStats(ASS_Image *images, int changed, int64_t renderTimeUs,
+                              bool prerender) {
+    // libass frees the last frame's images only after rendering the new ones, same address is
+    // the same cached bitmap
+    mTmpBitmaps.clear();
+    unsigned long reused = 0;
+    for (ASS_Image* image = images; image != nullptr; image = image->next) {
+        if (changed == 0 || std::binary_search(mLastBitmaps.begin(), mLastBitmaps.end(),
+                                               image->bitmap)) {
+            reused++;
+        }
+        mTmpBitmaps.push_back(image->bitmap);
+    }
+    std::sort(mTmpBitmaps.begin(), mTmpBitmaps.end());
+    mLastBitmaps.swap(mTmpBitmaps);
+
+    std::lock_guard<std::mutex> lk(mStatsMutex);
+    if (prerender) {
+        mStats.prerenderedFrames++;
+        mStats.prerenderTimeUs += renderTimeUs;
+        return;
+    }
+    mStats.frames++;
+    if (changed > 0) {
+        mStats.changedFrames++;
+    }
+    mStats.images += mLastBitmaps.size();
+    mStats.reusedImages += reused;
+    mStats.renderTimeUs += renderTimeUs;
+    mStats.maxRenderTimeUs = std::max(mStats.maxRenderTimeUs, renderTimeUs);
 }
 
 int ASSRenderer::getError() {
@@ -139,7 +230,7 @@ ASSBitmap **ASSRenderer::getBitmaps(ASS_Track *track, long long time, int *size,
     }
     mTmpBitmapCount = 0;
 
-    ASS_Image *images = ass_render_frame(mAssRenderer, track, time, changed);
+    ASS_Image *images = renderFrame(track, time, changed);
     if (*changed == 0 || images == nullptr) {
         if (track->n_events == 0) {
             *changed = 0;
@@ -164,35 +255,21 @@ ASSBitmap **ASSRenderer::getBitmaps(ASS_Track *track, long long time, int *size,
             mTmpBitmapBuffer[i]->clear();
         }
     }
-    mTmpBitmapBuffer[0]->add(images);
-    mTmpBitmapCount = 1;
-
-    // Organize the the rest of the images to separate zones for blending later
-    ASS_Image *curImg = images->next;
-    while (curImg != nullptr) {
-        // See if this image overlaps area with over images already in the list
-        bool sorted = false;
-        for (int i = 0; i < mTmpBitmapCount; ++i) {
-            if (mTmpBitmapBuffer[i]->overlaps(curImg)) {
-                mTmpBitmapBuffer[i]->add(curImg);
-                sorted = true;
-                break;
-            }
-        }
-        if (!sorted) {
-            // Did not overlap so add it to the list
-            ensureTmpBufferCapacity(mTmpBitmapCount + 1);
-            mTmpBitmapBuffer[mTmpBitmapCount]->add(curImg);
-            mTmpBitmapCount++;
-        }
-        curImg = curImg->next;
-    }
+
+    // Organize the images to separate zones for blending later
+    groupImages(images);
 
     // Check for the differences between this and last frame, move all bitmaps that did not change
     // and only blends new images if they have changed
     if (mBitmapBuffer && mBitmapCount > 0) {
         int oldImagesChanged = 0;
 
+        // Index the new bitmaps by their key so each old bitmap only compares with likely matches
+        mBitmapKeys.clear();
+        for (int newIndex = 0; newIndex < mTmpBitmapCount; ++newIndex) {
+            mBitmapKeys.emplace(mTmpBitmapBuffer[newIndex]->key, newIndex);
+        }
+
         // Try to match each old bitmaps with new bitmaps, check if there was any changes, mark it
         // changed and then add them to the list to remove
         for (size_t oldIndex = 0; oldIndex < mBitmapCount; ++oldIndex) {
@@ -203,15 +280,15 @@ ASSBitmap **ASSRenderer::getBitmaps(ASS_Track *track, long long time, int *size,
             }
             oldBitmap->changed = true;
 
-            for (size_t newIndex = 0; newIndex < mTmpBitmapCount; ++newIndex) {
+            auto range = mBitmapKeys.equal_range(oldBitmap->key);
+            for (auto it = range.first; it != range.second; ++it) {
+                const int newIndex = it->second;
                 ASSBitmap* newBitmap = mTmpBitmapBuffer[newIndex];
-                if (newBitmap->changed && oldBitmap->compare(newBitmap) == 0) {
-                    // Data matches, mark both as not changed, then swap the new and old bitmaps to
-                    // carry on the original data (at the end the two lists are swapped)
-                    newBitmap->size = 0;
+                if (newBitmap->changed && oldBitmap->compare(newBitmap) < 2) {
+                    // Same pixels, maybe moved, so the new bitmap keeps the flattened data of the
+                    // old one and only its position is updated. Mark both as not changed
+                    newBitmap->swapBuffer(oldBitmap);
                     oldBitmap->changed = newBitmap->changed = false;
-                    mTmpBitmapBuffer[newIndex] = oldBitmap;
-                    mBitmapBuffer[oldIndex] = newBitmap;
                     break;
                 }
             }
@@ -258,6 +335,98 @@ ASSBitmap **ASSRenderer::getBitmaps(ASS_Track *track, long long time, int *size,
     return mBitmapBuffer;
 }
 
+void ASSRenderer::groupImages(ASS_Image *images) {
+    mImages.clear();
+    for (ASS_Image* img = images; img != nullptr; img = img->next) {
+        mImages.push_back(img);
+    }
+    const int n = (int) mImages.size();
+
+    // Each image starts in its own set, join the sets of images that overlap
+    mParents.resize((size_t) n);
+    mBoxes.clear();
+    for (int i = 0; i < n; ++i) {
+        ASS_Image* img = mImages[i];
+        mParents[i] = i;
+        mBoxes.push_back({img->dst_x, img->dst_y, img->dst_x + img->w, img->dst_y + img->h, i});
+    }
+
+    // Joined sets can now overlap other sets with their combined bounds, repeat till none do
+    while (unionOverlappingBoxes()) {
+        mGroupIndexes.assign((size_t) n, -1);
+        size_t numBoxes = 0;
+        for (int i = 0; i < n; ++i) {
+            const int root = findRoot(i);
+            const Box imgBox = {mImages[i]->dst_x, mImages[i]->dst_y,
+                                 mImages[i]->dst_x + mImages[i]->w,
+                                 mImages[i]->dst_y + mImages[i]->h, root};
+            if (mGroupIndexes[root] < 0) {
+                mGroupIndexes[root] = (int) numBoxes;
+                mBoxes[numBoxes++] = imgBox;
+            } else {
+                Box& box = mBoxes[mGroupIndexes[root]];
+                box.x1 = std::min(box.x1, imgBox.x1);
+                box.y1 = std::min(box.y1, imgBox.y1);
+                box.x2 = std::max(box.x2, imgBox.x2);
+                box.y2 = std::max(box.y2, imgBox.y2);
+            }
+        }
+        mBoxes.resize(numBoxes);
+    }
+
+    // Add images to the bitmap of their set, keeping libass's order for blending
+    mGroupIndexes.assign((size_t) n, -1);
+    mTmpBitmapCount = 0;
+    for (int i = 0; i < n; ++i) {
+        const int root = findRoot(i);
+        if (mGroupIndexes[root] < 0) {
+            ensureTmpBufferCapacity(mTmpBitmapCount + 1);
+            mGroupIndexes[root] = mTmpBitmapCount++;
+        }
+        mTmpBitmapBuffer[mGroupIndexes[root]]->add(mImages[i], mContentHashEnabled);
+    }
+}
+
+bool ASSRenderer::unionOverlappingBoxes() {
+    // Sweep from left to right, only boxes still open at this x can overlap the next one
+    std::sort(mBoxes.begin(), mBoxes.end(), [](const Box& a, const Box& b) {
+        return a.x1 < b.x1;
+    });
+    mActiveBoxes.clear();
+    bool merged = false;
+    for (const Box& box : mBoxes) {
+        size_t numActive = 0;
+        for (size_t i = 0; i < mActiveBoxes.size(); ++i) {
+            if (mActiveBoxes[i].x2 > box.x1) {
+                mActiveBoxes[numActive++] = mActiveBoxes[i];
+            }
+        }
+        mActiveBoxes.resize(numActive);
+
+        for (const Box& other : mActiveBoxes) {
+            if (other.y1 < box.y2 && other.y2 > box.y1 && box.x2 > other.x1) {
+                int a = findRoot(other.id);
+                int b = findRoot(box.id);
+                if (a != b) {
+                    // Lowest index stays the root so sets keep the order of their first image
+                    mParents[std::max(a, b)] = std::min(a, b);
+                    merged = true;
+                }
+            }
+        }
+        mActiveBoxes.push_back(box);
+    }
+    return merged;
+}
+
+int ASSRenderer::findRoot(int index) {
+    while (mParents[index] != index) {
+        mParents[index] = mParents[mParents[index]];
+        index = mParents[index];
+    }
+    return index;
+}
+
 void ASSRenderer::swapBuffers() {
     ASSBitmap** tmp = mTmpBitmapBuffer;
     mTmpBitmapBuffer = mBitmapBuffer;
@@ -2,10 +2,27 @@
 #define VPLAYER_LIB2_ASSRENDERER_H
 
 #include "ASSBitmap.h"
+#include "ASSLibraryCache.h"
 #include <vector>
+#include <unordered_map>
+#include <mutex>
 
 class ASSRenderer {
 public:
+    struct Stats {
+        unsigned long frames;
+        // Frames libass reported as different from the frame before
+        unsigned long changedFrames;
+        unsigned long images;
+        // Images whose bitmap was kept from the frame before, libass served them from its cache
+        unsigned long reusedImages;
+        int64_t renderTimeUs;
+        int64_t maxRenderTimeUs;
+        // Upcoming frames rendered ahead of time to fill the caches
+        unsigned long prerenderedFrames;
+        int64_t prerenderTimeUs;
+    };
+
     ASSRenderer();
     ~ASSRenderer();
 
@@ -13,24 +30,68 @@ public:
 
     void setDefaultFont(const char* fontPath, const char* fontFamilyName);
 
-    void addFont(char* name, char* data, int size);
+    /**
+     * Register a font with the library, identical font data is only registered once
+     * @param updateFonts rebuild the font provider now, pass false when adding many fonts and
+     *                    call updateFonts() once after the last one
+     */
+    void addFont(char* name, char* data, int size, bool updateFonts = true);
+
+    // Rebuild the font provider if fonts were added since the last update
+    void updateFonts();
 
     ASS_Track* createTrack(const char* data, int size);
 
     ASS_Image* renderFrame(ASS_Track *track, long long time, int *changed);
 
+    /**
+     * Render a frame ahead of time only so its glyphs and bitmaps are cached when it is shown.
+     * The next renderFrame() compares against this frame for changes instead of the last shown.
+     */
+    void prerenderFrame(ASS_Track *track, long long time);
+
     ASSBitmap** getBitmaps(ASS_Track *track, long long time, int* size, int* changed);
 
+    // Detect unchanged images by their pixels instead of their memory address, default on
+    void setContentHashEnabled(bool enabled);
+
+    /**
+     * Limit the memory libass keeps for glyph outlines and rendered bitmaps. Heavy typesetting
+     * needs more than the defaults to avoid rasterising the same glyphs every frame.
+     * @param megabytes memory for the caches, 0 to use the libass defaults
+     */
+    void setCacheBudget(int megabytes);
+
+    Stats getStats();
+    void resetStats();
+
     int getError();
 
 private:
+    struct Box {
+        int x1;
+        int y1;
+        int x2;
+        int y2;
+        int id;
+    };
+
+    void groupImages(ASS_Image* images);
+    bool unionOverlappingBoxes();
+    int findRoot(int index);
     void swapBuffers();
 
     void ensureTmpBufferCapacity(int size);
+    void applyFonts();
+    ASS_Image* render(ASS_Track *track, long long time, int *changed, bool prerender);
+    void updateStats(ASS_Image* images, int changed, int64_t renderTimeUs, bool prerender);
 
     int mError;
+    bool mContentHashEnabled;
+    // Library is shared by all renderers, the renderer is reused once this is destroyed
     ASS_Library* mAssLibrary;
     ASS_Renderer* mAssRenderer;
+    unsigned long mFontGeneration;
 
     // Buffers, returned swap so that differences can be detected
     ASSBitmap** mBitmapBuffer;
@@ -41,10 +102,22 @@ private:
     int mTmpBitmapCapacity;
     int mTmpBitmapCount;
 
-    char* mDefaultFontPath;
-    size_t mDefaultFontPathCapacity;
-    char* mDefaultFontName;
-    size_t mDefaultFontNameCapacity;
+    // Reused each frame when grouping images into bitmaps
+    std::vector<ASS_Image*> mImages;
+    std::vector<int> mParents;
+    std::vector<int> mGroupIndexes;
+    std::vector<Box> mBoxes;
+    std::vector<Box> mActiveBoxes;
+    std::unordered_multimap<uint64_t, int> mBitmapKeys;
+
+    std::string mDefaultFontPath;
+    std::string mDefaultFontName;
+
+    std::mutex mStatsMutex;
+    Stats mStats;
+    // Sorted bitmaps of the last frame rendered, to count the ones reused
+    std::vector<const unsigned char*> mLastBitmaps;
+    std::vector<const unsigned char*> mTmpBitmaps;
 };
 
 #endif // VPLAYER_LIB2_ASSRENDERER_H
\ No newline at end of file
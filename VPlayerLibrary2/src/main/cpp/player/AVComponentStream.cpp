@@ -8,6 +8,7 @@ AVComponentStream::AVComponentStream(AVFormatContext *context, enum AVMediaType
         StreamComponent(context, type, flushPkt, callback),
         mClock(NULL),
         mQueue(NULL),
+        mPlaybackSpeed(1),
         mQueueMaxSize(maxSize),
         mRenderThread(NULL) {
 }
@@ -28,12 +29,21 @@ void AVComponentStream::setPaused(bool paused) {
     }
 }
 
+void AVComponentStream::setPlaybackSpeed(double speed) {
+    mPlaybackSpeed = speed;
+    if (mClock && mQueue) {
+        std::lock_guard<std::mutex> lk(mQueue->getMutex());
+        mClock->setSpeed(speed);
+    }
+}
+
 int AVComponentStream::open() {
     internalCleanUp();
 
     int ret = StreamComponent::open();
     if (ret >= 0) {
         mClock = new Clock(&mPacketQueue->serial());
+        mClock->setSpeed(mPlaybackSpeed);
         mQueue = new FrameQueue(type(), mQueueMaxSize);
     }
     return ret;
@@ -1,6 +1,7 @@
 #ifndef AVCOMPONENTSTREAM_H
 #define AVCOMPONENTSTREAM_H
 
+#include <atomic>
 #include "StreamComponent.h"
 #include "FrameQueue.h"
 #include "Clock.h"
@@ -24,6 +25,12 @@ public:
         return mClock;
     }
 
+    /**
+     * Play the stream faster or slower, its clock runs at this speed
+     * @param speed 1 for normal playback
+     */
+    virtual void setPlaybackSpeed(double speed);
+
 protected:
     virtual int onRenderThread() = 0;
     virtual void onAVFrameReceived(AVFrame *frame) = 0;
@@ -45,6 +52,7 @@ protected:
 
     FrameQueue* mQueue;
     Clock* mClock;
+    std::atomic<double> mPlaybackSpeed;
 
 private:
     void internalRenderThread();
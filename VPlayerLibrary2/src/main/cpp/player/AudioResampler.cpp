@@ -0,0 +1,291 @@
+#include "AudioResampler.h"
+#include <cmath>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+#define RESAMPLE_NEON 1
+#include <arm_neon.h>
+#elif defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define RESAMPLE_SSE2 1
+#include <immintrin.h>
+#endif
+
+// Input formats kept at once, the least recently used resampler is dropped for another one
+#define MAX_RESAMPLERS 4
+
+#define DEFAULT_QUALITY 1
+
+// Audio kept going through swresample after the last compensation, so the sync corrections that
+// come and go do not switch paths each time
+#define COMPENSATION_HOLD_MS 2000
+
+static const char* sTag = "AudioResampler";
+
+// Filter settings per quality, the best matches swresample's own defaults
+static const struct {
+    int filterSize;
+    int phaseShift;
+    int linearInterp;
+} sQualities[] = {
+        {8, 6, 0},
+        {16, 8, 1},
+        {32, 10, 1},
+};
+
+static void fltpToS16StereoC(int16_t *dst, const float *left, const float *right, int count) {
+    for (int i = 0; i < count; i++) {
+        *dst++ = (int16_t) lrintf(av_clipf(left[i] * 32768.0f, -32768.0f, 32767.0f));
+        *dst++ = (int16_t) lrintf(av_clipf(right[i] * 32768.0f, -32768.0f, 32767.0f));
+    }
+}
+
+static void fltpToFltStereoC(float *dst, const float *left, const float *right, int count) {
+    for (int i = 0; i < count; i++) {
+        *dst++ = left[i];
+        *dst++ = right[i];
+    }
+}
+
+#if defined(RESAMPLE_NEON)
+
+// Convert to 1.31 fixed point, then round and saturate down to 16 bits
+static inline int16x8_t floatToS16Neon(const float *src) {
+    return vcombine_s16(vqrshrn_n_s32(vcvtq_n_s32_f32(vld1q_f32(src), 31), 16),
+                        vqrshrn_n_s32(vcvtq_n_s32_f32(vld1q_f32(src + 4), 31), 16));
+}
+
+// 8 samples per channel per iteration, interleaved on store
+static void fltpToS16Stereo(int16_t *dst, const float *left, const float *right, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8, dst += 16) {
+        int16x8x2_t s;
+        s.val[0] = floatToS16Neon(left + i);
+        s.val[1] = floatToS16Neon(right + i);
+        vst2q_s16(dst, s);
+    }
+    fltpToS16StereoC(dst, left + i, right + i, count - i);
+}
+
+static void fltpToFltStereo(float *dst, const float *left, const float *right, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4, dst += 8) {
+        float32x4x2_t s;
+        s.val[0] = vld1q_f32(left + i);
+        s.val[1] = vld1q_f32(right + i);
+        vst2q_f32(dst, s);
+    }
+    fltpToFltStereoC(dst, left + i, right + i, count - i);
+}
+
+#elif defined(RESAMPLE_SSE2)
+
+static inline __m128i floatToS32Sse2(const float *src) {
+    const __m128 v = _mm_mul_ps(_mm_loadu_ps(src), _mm_set1_ps(32768.0f));
+    return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-32768.0f)),
+                                      _mm_set1_ps(32767.0f)));
+}
+
+// 8 samples per channel per iteration
+static void fltpToS16Stereo(int16_t *dst, const float *left, const float *right, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8, dst += 16) {
+        const __m128i l = _mm_packs_epi32(floatToS32Sse2(left + i), floatToS32Sse2(left + i + 4));
+        const __m128i r = _mm_packs_epi32(floatToS32Sse2(right + i),
+                                          floatToS32Sse2(right + i + 4));
+        _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128((__m128i *) (dst + 8), _mm_unpackhi_epi16(l, r));
+    }
+    fltpToS16StereoC(dst, left + i, right + i, count - i);
+}
+
+static void fltpToFltStereo(float *dst, const float *left, const float *right, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4, dst += 8) {
+        const __m128 l = _mm_loadu_ps(left + i);
+        const __m128 r = _mm_loadu_ps(right + i);
+        _mm_storeu_ps(dst, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(dst + 4, _mm_unpackhi_ps(l, r));
+    }
+    fltpToFltStereoC(dst, left + i, right + i, count - i);
+}
+
+#else
+
+static void fltpToS16Stereo(int16_t *dst, const float *left, const float *right, int count) {
+    fltpToS16StereoC(dst, left, right, count);
+}
+
+static void fltpToFltStereo(float *dst, const float *left, const float *right, int count) {
+    fltpToFltStereoC(dst, left, right, count);
+}
+
+#endif
+
+AudioResampler::AudioResampler() :
+        mUseCount(0),
+        mQuality(DEFAULT_QUALITY),
+        mAppliedQuality(DEFAULT_QUALITY),
+        mOutLayout(0),
+        mOutFormat(AV_SAMPLE_FMT_NONE),
+        mOutSampleRate(0),
+        mOutChannels(0) {
+}
+
+AudioResampler::~AudioResampler() {
+    clear();
+}
+
+void AudioResampler::setQuality(int quality) {
+    mQuality = av_clip(quality, 0, (int) (sizeof(sQualities) / sizeof(sQualities[0])) - 1);
+}
+
+void AudioResampler::setOutput(int64_t layout, enum AVSampleFormat format, int sampleRate) {
+    if (layout != mOutLayout || format != mOutFormat || sampleRate != mOutSampleRate) {
+        clear();
+        mOutLayout = layout;
+        mOutFormat = format;
+        mOutSampleRate = sampleRate;
+        mOutChannels = av_get_channel_layout_nb_channels((uint64_t) layout);
+    }
+}
+
+int AudioResampler::convert(AVFrame *frame, int64_t inLayout, int wantedNbSamples, uint8_t *out,
+                            int outCount) {
+    int ret, len;
+    const int quality = mQuality;
+    if (quality != mAppliedQuality) {
+        // Audio held by the old resamplers is lost, a few milliseconds at most
+        clear();
+        mAppliedQuality = quality;
+    }
+
+    Entry* entry = findEntry(frame->format, inLayout, frame->sample_rate);
+    if (entry) {
+        entry->lastUsed = ++mUseCount;
+    }
+
+    // Skip swresample when only the sample format changes, or nothing does
+    const bool direct = wantedNbSamples == frame->nb_samples && inLayout == mOutLayout
+                        && frame->sample_rate == mOutSampleRate
+                        && !(entry && entry->holdSamples > 0);
+    const bool copy = direct && frame->format == mOutFormat
+                      && (!av_sample_fmt_is_planar(mOutFormat) || mOutChannels == 1);
+    const bool interleave = direct && frame->format == AV_SAMPLE_FMT_FLTP
+                            && (mOutFormat == AV_SAMPLE_FMT_S16 || mOutFormat == AV_SAMPLE_FMT_FLT)
+                            && inLayout == AV_CH_LAYOUT_STEREO;
+    if (copy || interleave) {
+        if (entry && entry->pending) {
+            resetEntry(entry);
+        }
+        const int count = FFMIN(frame->nb_samples, outCount);
+        if (copy) {
+            const int frameSize = mOutChannels * av_get_bytes_per_sample(mOutFormat);
+            memcpy(out, frame->data[0], (size_t) count * frameSize);
+        } else if (mOutFormat == AV_SAMPLE_FMT_FLT) {
+            fltpToFltStereo((float *) out, (const float *) frame->data[0],
+                            (const float *) frame->data[1], count);
+        } else {
+            fltpToS16Stereo((int16_t *) out, (const float *) frame->data[0],
+                            (const float *) frame->data[1], count);
+        }
+        return count;
+    }
+
+    if (!entry && (ret = createEntry(frame->format, inLayout, frame->sample_rate, &entry)) < 0) {
+        return ret;
+    }
+    if (wantedNbSamples != frame->nb_samples) {
+        const double ratio = (double) mOutSampleRate / frame->sample_rate;
+        if ((ret = swr_set_compensation(entry->swr,
+                                        (int) ((wantedNbSamples - frame->nb_samples) * ratio),
+                                        (int) (wantedNbSamples * ratio))) < 0) {
+            __android_log_print(ANDROID_LOG_ERROR, sTag, "swr_set_compensation() failed");
+            return ret;
+        }
+        entry->holdSamples = (int64_t) frame->sample_rate * COMPENSATION_HOLD_MS / 1000;
+    } else if (entry->holdSamples > 0) {
+        entry->holdSamples = FFMAX(entry->holdSamples - frame->nb_samples, 0);
+    }
+    if ((len = swr_convert(entry->swr, &out, outCount, (const uint8_t **) frame->extended_data,
+                           frame->nb_samples)) < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag, "swr_convert() failed");
+        return len;
+    }
+    entry->pending = true;
+    if (len == outCount) {
+        __android_log_print(ANDROID_LOG_WARN, sTag, "audio buffer is probably too small");
+        if (swr_init(entry->swr) < 0) {
+            removeEntry(entry);
+        }
+    }
+    return len;
+}
+
+void AudioResampler::clear() {
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        swr_free(&mEntries[i].swr);
+    }
+    mEntries.clear();
+}
+
+AudioResampler::Entry *AudioResampler::findEntry(int format, int64_t layout, int sampleRate) {
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        Entry& entry = mEntries[i];
+        if (entry.format == format && entry.layout == layout && entry.sampleRate == sampleRate) {
+            return &entry;
+        }
+    }
+    return NULL;
+}
+
+int AudioResampler::createEntry(int format, int64_t layout, int sampleRate, Entry **outEntry) {
+    int ret;
+    if (mEntries.size() >= MAX_RESAMPLERS) {
+        Entry* oldest = &mEntries[0];
+        for (size_t i = 1; i < mEntries.size(); i++) {
+            if (mEntries[i].lastUsed < oldest->lastUsed) {
+                oldest = &mEntries[i];
+            }
+        }
+        removeEntry(oldest);
+    }
+
+    struct SwrContext* swr = swr_alloc_set_opts(NULL, mOutLayout, mOutFormat, mOutSampleRate,
+                                                layout, (enum AVSampleFormat) format, sampleRate,
+                                                0, NULL);
+    if (!swr) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag, "Unable to create audio swr");
+        return AVERROR(ENOMEM);
+    }
+    av_opt_set_int(swr, "filter_size", sQualities[mAppliedQuality].filterSize, 0);
+    av_opt_set_int(swr, "phase_shift", sQualities[mAppliedQuality].phaseShift, 0);
+    av_opt_set_int(swr, "linear_interp", sQualities[mAppliedQuality].linearInterp, 0);
+    if ((ret = swr_init(swr)) < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag, "Failed to init audio swr");
+        swr_free(&swr);
+        return ret;
+    }
+
+    Entry entry = {swr, format, layout, sampleRate, ++mUseCount, 0, false};
+    mEntries.push_back(entry);
+    *outEntry = &mEntries.back();
+    return 0;
+}
+
+void AudioResampler::removeEntry(Entry *entry) {
+    swr_free(&entry->swr);
+    mEntries.erase(mEntries.begin() + (entry - &mEntries[0]));
+}
+
+void AudioResampler::resetEntry(Entry *entry) {
+    // Drops the filter delay, under a millisecond, flushing would pad it with silence and click
+    entry->pending = false;
+    if (swr_init(entry->swr) < 0) {
+        __android_log_print(ANDROID_LOG_WARN, sTag, "Unable to reset audio swr");
+        removeEntry(entry);
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef AUDIORESAMPLER_H
+#define AUDIORESAMPLER_H
+
+extern "C" {
+#include <libswresample/swresample.h>
+#include <libavutil/frame.h>
+}
+#include <atomic>
+#include <vector>
+#include <android/log.h>
+
+/**
+ * Converts decoded audio to the format of the renderer. Resamplers are kept for each input format
+ * (sample format, channel layout and rate) seen, so streams switching formats do not rebuild them.
+ * Audio that only needs planar float stereo interleaved to float or signed 16 bit, or no conversion
+ * at all, skips swresample unless clock synchronization asks for samples to be added or removed.
+ * After that it stays on swresample until no samples were added or removed for a while.
+ */
+class AudioResampler {
+public:
+    AudioResampler();
+    ~AudioResampler();
+
+    /**
+     * Filter quality of new resamplers, existing ones are rebuilt with the next conversion
+     * @param quality 0 fastest, 1 default, 2 best
+     */
+    void setQuality(int quality);
+
+    // Format all audio is converted to, changing it drops the resamplers
+    void setOutput(int64_t layout, enum AVSampleFormat format, int sampleRate);
+
+    /**
+     * Convert a frame into interleaved output
+     * @param inLayout channel layout of the frame
+     * @param wantedNumSamples samples the frame should have after clock synchronization, the
+     *                         difference is compensated over those samples
+     * @param out buffer for at least outCount samples
+     * @return samples per channel written or negative error
+     */
+    int convert(AVFrame* frame, int64_t inLayout, int wantedNumSamples, uint8_t* out,
+                int outCount);
+
+    void clear();
+
+private:
+    struct Entry {
+        struct SwrContext* swr;
+        int format;
+        int64_t layout;
+        int sampleRate;
+        uint64_t lastUsed;
+
+        // Samples left to convert with the resampler since it last compensated
+        int64_t holdSamples;
+
+        // Samples may be buffered in the resampler, it is reset before converting without it
+        bool pending;
+    };
+
+    Entry* findEntry(int format, int64_t layout, int sampleRate);
+    int createEntry(int format, int64_t layout, int sampleRate, Entry** outEntry);
+    void removeEntry(Entry* entry);
+    void resetEntry(Entry* entry);
+
+    std::vector<Entry> mEntries;
+    uint64_t mUseCount;
+    std::atomic<int> mQuality;
+    int mAppliedQuality;
+
+    int64_t mOutLayout;
+    enum AVSampleFormat mOutFormat;
+    int mOutSampleRate;
+    int mOutChannels;
+};
+
+#endif //AUDIORESAMPLER_H
@@ -0,0 +1,57 @@
+#include "AudioRingBuffer.h"
+#include <algorithm>
+#include <cstring>
+
+AudioRingBuffer::AudioRingBuffer(size_t capacity) :
+        mData(new uint8_t[capacity]),
+        mCapacity(capacity),
+        mWritePos(0),
+        mReadPos(0),
+        mDiscardPos(0) {
+}
+
+AudioRingBuffer::~AudioRingBuffer() {
+    delete[] mData;
+}
+
+size_t AudioRingBuffer::write(const uint8_t *data, size_t size) {
+    const uint64_t writePos = mWritePos.load(std::memory_order_relaxed);
+    const uint64_t readPos = mReadPos.load(std::memory_order_acquire);
+    const size_t length = std::min(size, mCapacity - (size_t) (writePos - readPos));
+    if (length == 0) {
+        return 0;
+    }
+
+    // Copy up to the end of the ring and the rest from the start
+    const size_t offset = (size_t) (writePos % mCapacity);
+    const size_t first = std::min(length, mCapacity - offset);
+    memcpy(mData + offset, data, first);
+    memcpy(mData, data + first, length - first);
+    mWritePos.store(writePos + length, std::memory_order_release);
+    return length;
+}
+
+size_t AudioRingBuffer::read(uint8_t *out, size_t size) {
+    uint64_t readPos = std::max(mReadPos.load(std::memory_order_relaxed),
+                                mDiscardPos.load(std::memory_order_acquire));
+    const uint64_t writePos = mWritePos.load(std::memory_order_acquire);
+    const size_t length = std::min(size, (size_t) (writePos - readPos));
+
+    const size_t offset = (size_t) (readPos % mCapacity);
+    const size_t first = std::min(length, mCapacity - offset);
+    memcpy(out, mData + offset, first);
+    memcpy(out + first, mData, length - first);
+    mReadPos.store(readPos + length, std::memory_order_release);
+    return length;
+}
+
+void AudioRingBuffer::discard() {
+    mDiscardPos.store(mWritePos.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+size_t AudioRingBuffer::available() {
+    const uint64_t readPos = std::max(mReadPos.load(std::memory_order_acquire),
+                                      mDiscardPos.load(std::memory_order_acquire));
+    const uint64_t writePos = mWritePos.load(std::memory_order_acquire);
+    return writePos > readPos ? (size_t) (writePos - readPos) : 0;
+}
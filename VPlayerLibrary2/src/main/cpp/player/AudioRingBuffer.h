@@ -0,0 +1,48 @@
+#ifndef AUDIORINGBUFFER_H
+#define AUDIORINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Lock-free ring of audio bytes between one writing thread and one reading thread. Each side only
+ * moves its own position, which never wraps, so neither has to wait for the other; an audio
+ * callback can read from it without taking a lock.
+ */
+class AudioRingBuffer {
+public:
+    AudioRingBuffer(size_t capacity);
+    ~AudioRingBuffer();
+
+    /**
+     * Copy as much of the data as fits, called from the writing thread
+     * @return number of bytes written, 0 if full
+     */
+    size_t write(const uint8_t* data, size_t size);
+
+    /**
+     * Copy out as much queued data as available, called from the reading thread
+     * @return number of bytes read, 0 if empty
+     */
+    size_t read(uint8_t* out, size_t size);
+
+    // Drop everything written so far, the reader skips it on its next read
+    void discard();
+
+    // Bytes queued and not read yet
+    size_t available();
+
+    size_t capacity() {
+        return mCapacity;
+    }
+
+private:
+    uint8_t* mData;
+    const size_t mCapacity;
+    std::atomic<uint64_t> mWritePos;
+    std::atomic<uint64_t> mReadPos;
+    std::atomic<uint64_t> mDiscardPos;
+};
+
+#endif //AUDIORINGBUFFER_H
@@ -4,6 +4,9 @@
 #define SAMPLE_CORRECTION_PERCENT_MAX 10
 #define FRAME_STEP_SLEEP_TIMEOUT 10
 
+// Decoded audio is written to the renderer in batches of about this length
+#define AUDIO_BATCH_MS 40
+
 // We use about AUDIO_DIFF_AVG_NB A-V differences to make the average
 #define AUDIO_DIFF_AVG_NB 20
 
@@ -13,18 +16,32 @@ const static char* sTag = "AudioStream";
 
 AudioStream::AudioStream(AVFormatContext* context, AVPacket* flushPkt, ICallback* callback) :
         AVComponentStream(context, AVMEDIA_TYPE_AUDIO, flushPkt, callback, SAMPLE_QUEUE_SIZE),
-        mAudioRenderer(NULL),
-        mSwrContext(NULL),
-        mAudioBuffer(NULL),
-        mBufferSize(0),
         mStartPts(AV_NOPTS_VALUE),
-        mLatencyInvalidated(false),
+        mAudioRenderer(NULL),
         mIsMuted(false),
         mMuteRequested(false),
+        mLatencyInvalidated(false),
         mPlaybackStateChanged(false),
+        mAudioBuffer(NULL),
+        mBufferSize(0),
+        mBatch(NULL),
+        mBatchSize(0),
+        mBatchSamples(0),
+        mBatchPts(NAN),
+        mBatchStart(0),
+        mBatchSerial(0),
+        mPassthrough(false),
+        mPassthroughPending(false),
+        mTempoFrame(av_frame_alloc()),
+        mTempoSpeed(1),
+        mTempoPts(NAN),
+        mTempoSerial(0),
         mDiffComputation(0),
         mDiffAvgCoef(exp(log(0.01) / AUDIO_DIFF_AVG_NB)),
         mDiffAvgCount(0) {
+    av_init_packet(&mPassthroughPkt);
+    mPassthroughPkt.data = NULL;
+    mPassthroughPkt.size = 0;
 }
 
 AudioStream::~AudioStream() {
@@ -36,13 +53,11 @@ AudioStream::~AudioStream() {
         mAudioRenderer->flush();
         mAudioRenderer = NULL;
     }
-    if (mSwrContext) {
-        swr_free(&mSwrContext);
-        mSwrContext = NULL;
-    }
     if (mAudioBuffer) {
         av_freep(&mAudioBuffer);
     }
+    av_frame_free(&mTempoFrame);
+    av_packet_unref(&mPassthroughPkt);
 }
 
 void AudioStream::setPaused(bool paused) {
@@ -50,6 +65,11 @@ void AudioStream::setPaused(bool paused) {
     AVComponentStream::setPaused(paused);
 }
 
+void AudioStream::setPlaybackSpeed(double speed) {
+    // Compressed audio only plays at normal speed, the video follows it
+    AVComponentStream::setPlaybackSpeed(mPassthrough ? 1 : speed);
+}
+
 void AudioStream::setMute(bool mute) {
     if (mIsMuted != mute) {
         mMuteRequested = true;
@@ -57,12 +77,17 @@ void AudioStream::setMute(bool mute) {
     }
 }
 
+void AudioStream::setResampleQuality(int quality) {
+    mResampler.setQuality(quality);
+}
+
 void AudioStream::invalidateLatency() {
     mLatencyInvalidated = true;
 }
 
 double AudioStream::getLatency() {
-    return mAudioRenderer ? mAudioRenderer->getLatency() : 0;
+    // Audio queued in the renderer covers more of the stream when played faster
+    return mAudioRenderer ? mAudioRenderer->getLatency() * mPlaybackSpeed : 0;
 }
 
 AVDictionary *AudioStream::getPropertiesOfStream(AVCodecContext* cContext, AVStream* stream,
@@ -90,12 +115,76 @@ void AudioStream::onAVFrameReceived(AVFrame *frame) {
 void AudioStream::onDecodeFlushBuffers() {
     mNextPts = mStartPts;
     mNextPtsTb = mStartPtsTb;
+    av_packet_unref(&mPassthroughPkt);
+    mPassthroughPending = false;
+}
+
+void AudioStream::onDecodeFrame(void *frame, AVPacket *pkt, int *outRetCode) {
+    if (!mPassthrough) {
+        AVComponentStream::onDecodeFrame(frame, pkt, outRetCode);
+        return;
+    }
+    av_packet_unref(&mPassthroughPkt);
+    if (pkt->size > 0 && av_packet_ref(&mPassthroughPkt, pkt) >= 0) {
+        mPassthroughPending = true;
+    }
+}
+
+void AudioStream::onReceiveDecodingFrame(void *frame, int *outRetCode) {
+    if (!mPassthrough) {
+        AVComponentStream::onReceiveDecodingFrame(frame, outRetCode);
+        return;
+    } else if (!mPassthroughPending) {
+        *outRetCode = AVERROR(EAGAIN);
+        return;
+    }
+    mPassthroughPending = false;
+
+    // Wrap the packet in a frame so it is queued and timed like decoded audio
+    AVFrame* f = (AVFrame*) frame;
+    av_frame_unref(f);
+    if (!(f->buf[0] = av_buffer_ref(mPassthroughPkt.buf))) {
+        *outRetCode = AVERROR(ENOMEM);
+        return;
+    }
+    f->data[0] = mPassthroughPkt.data;
+    f->extended_data = f->data;
+    f->linesize[0] = mPassthroughPkt.size;
+    f->pkt_size = mPassthroughPkt.size;
+    f->pkt_pos = mPassthroughPkt.pos;
+    f->pts = mPassthroughPkt.pts;
+    f->nb_samples = getPassthroughSamples(&mPassthroughPkt);
+    f->sample_rate = mCContext->sample_rate;
+    f->channels = mCContext->channels;
+    f->channel_layout = mCContext->channel_layout;
+    av_packet_unref(&mPassthroughPkt);
+    onAVFrameReceived(f);
+    *outRetCode = 0;
+}
+
+int AudioStream::getPassthroughSamples(AVPacket *pkt) {
+    if (pkt->duration > 0) {
+        return (int) av_rescale_q(pkt->duration, mCContext->pkt_timebase,
+                                  (AVRational) {1, mCContext->sample_rate});
+    }
+    int samples = av_get_audio_frame_duration(mCContext, pkt->size);
+    return samples > 0 ? samples : mCContext->frame_size;
 }
 
 int AudioStream::onProcessThread() {
     Frame* af;
     int ret;
     AVRational tb;
+
+    // Created before decoding, packets skip the decoder if the sink takes them compressed
+    if ((mAudioRenderer = mCallback->createAudioRenderer(mCContext)) == NULL) {
+        return error(AVERROR(ENOMEM), "Cannot create audio renderer");
+    }
+    mPassthrough = mAudioRenderer->isPassthrough();
+    if (mPassthrough) {
+        __android_log_print(ANDROID_LOG_INFO, sTag, "Audio is passed through undecoded");
+    }
+
     AVFrame* avFrame = av_frame_alloc();
     if (!avFrame) {
         return error(AVERROR(ENOMEM), "Cannot allocate avframe for audio decoding");
@@ -129,11 +218,8 @@ int AudioStream::onProcessThread() {
 }
 
 int AudioStream::onRenderThread() {
-    if ((mAudioRenderer = mCallback->createAudioRenderer(mCContext)) == NULL) {
-        return error(AVERROR(ENOMEM), "Cannot create audio renderer");
-    }
-
     Frame *frame = nullptr;
+    int ret;
     while (!hasAborted()) {
         AVFrame *af;
 
@@ -203,20 +289,63 @@ int AudioStream::onRenderThread() {
             frameDecodeStart -= (Clock::now() - beforePauseTime);
         }
 
-        int wantedNbSamples = syncClocks(af);
-
-        // Write audio to renderer if not muted
-        if (!mIsMuted) {
-            uint8_t *audioData;
-            int size, written = 0;
-            if ((size = decodeAudioFrame(af, wantedNbSamples, &audioData)) < 0) {
+        const double speed = mPlaybackSpeed;
+        if (speed == 1) {
+            mTempoPts = NAN;
+            if (addToBatch(af, frame->pts(), frame->serial(), frameDecodeStart) < 0) {
                 // Failed to decode frame
                 break;
             }
+        } else {
+            // Stretch the audio to the speed, the filter starts again when the audio jumps
+            if (speed != mTempoSpeed || frame->serial() != mTempoSerial || isnan(mTempoPts)) {
+                mTempoFilter.flush();
+                mTempoSpeed = speed;
+                mTempoSerial = frame->serial();
+                mTempoPts = frame->pts();
+            }
+            if ((ret = mTempoFilter.sendFrame(af, speed)) < 0) {
+                error(ret, "Cannot change the tempo of audio");
+                break;
+            }
+
+            // Stream time of the stretched audio follows from how much of it came out
+            while ((ret = mTempoFilter.receiveFrame(mTempoFrame)) >= 0) {
+                const double pts = mTempoPts;
+                mTempoPts += (double) mTempoFrame->nb_samples * speed / mTempoFrame->sample_rate;
+                ret = addToBatch(mTempoFrame, pts, frame->serial(), frameDecodeStart);
+                av_frame_unref(mTempoFrame);
+                if (ret < 0) {
+                    break;
+                }
+            }
+            if (ret < 0 && ret != AVERROR(EAGAIN)) {
+                break;
+            }
+            if (mBatchSamples == 0) {
+                // Filter needs more audio
+                continue;
+            }
+        }
+
+        // Keep adding frames already decoded until the batch is long enough, unless something
+        // changed that needs the renderer now
+        if (mBatchSamples * 1000 < af->sample_rate * AUDIO_BATCH_MS
+                && mQueue->getNumRemaining() > 0
+                && mBatchSerial == mPacketQueue->serial()
+                && !mPlaybackStateChanged && !mMuteRequested && !mCallback->inFrameStepMode()) {
+            continue;
+        }
+
+        // Write audio to renderer if not muted
+        if (mBatchSize > 0) {
+            uint8_t *audioData = mBatch;
+            int size = mBatchSize, written = 0;
 
             // If renderer only writes partial audio then loop till all is written
-            while (written < size) {
-                int ret = mAudioRenderer->write(audioData + written, size);
+            while (size > 0) {
+                int samples = (int) ((int64_t) mBatchSamples * size / mBatchSize);
+                int ret = mAudioRenderer->write(audioData + written, size, samples);
                 if (hasAborted()) {
                     return 0;
                 }
@@ -231,90 +360,94 @@ int AudioStream::onRenderThread() {
             }
         } else {
             // Calculate the time to wait for a write operation to normally finish
-            int time = (int) (wantedNbSamples * (1000.0 / mAudioRenderer->sampleRate()));
+            int time = (int) (mBatchSamples * (1000.0 / mAudioRenderer->sampleRate()));
             std::this_thread::sleep_for(std::chrono::milliseconds(time));
         }
 
         // Update audio clock
-        updateClock(frame, frameDecodeStart);
+        updateClock(mBatchPts, mBatchSerial, mBatchStart);
+        mBatchSize = mBatchSamples = 0;
+    }
+    return 0;
+}
+
+int AudioStream::addToBatch(AVFrame *af, double pts, intptr_t serial, double time) {
+    int wantedNbSamples = syncClocks(af);
+    if (mBatchSamples > 0 && serial != mBatchSerial) {
+        // Audio from before a seek is stale, start the batch again with this frame
+        mBatchSize = mBatchSamples = 0;
+    }
+    if (mBatchSamples == 0) {
+        mBatchPts = pts;
+        mBatchSerial = serial;
+        mBatchStart = time;
+    }
+
+    // Add audio to the batch if not muted
+    if (!mIsMuted) {
+        int size;
+        if ((size = decodeAudioFrame(af, wantedNbSamples, mBatchSize, &mBatch)) < 0) {
+            return size;
+        }
+        mBatchSize += size;
     }
+    mBatchSamples += wantedNbSamples;
     return 0;
 }
 
-int AudioStream::decodeAudioFrame(AVFrame* af, int wantedNbSamples, uint8_t **out) {
-    int ret, len, size;
+int AudioStream::decodeAudioFrame(AVFrame* af, int wantedNbSamples, int offset,
+                                  uint8_t **outBatch) {
+    int len;
+    if (mPassthrough) {
+        if (!(*outBatch = reserveBatch(offset + af->pkt_size))) {
+            return error(AVERROR(ENOMEM), "Cannot create audio buffer");
+        }
+        memcpy(*outBatch + offset, af->data[0], (size_t) af->pkt_size);
+        return af->pkt_size;
+    }
+
     int numChannels = mAudioRenderer->numChannels();
     int sampleRate = mAudioRenderer->sampleRate();
     int64_t layout = mAudioRenderer->layout();
     enum AVSampleFormat format = mAudioRenderer->format();
+    mResampler.setOutput(layout, format, sampleRate);
 
-    // Create swr if needs conversion
     int64_t inLayout = (af->channel_layout
                         && af->channels == av_get_channel_layout_nb_channels(af->channel_layout))
                        ? (int64_t) af->channel_layout : av_get_default_channel_layout(af->channels);
 
-    if (af->format != format
-        || layout != inLayout
-        || af->sample_rate != sampleRate
-        || (wantedNbSamples != af->nb_samples && !mSwrContext)) {
-        swr_free(&mSwrContext);
-        mSwrContext = swr_alloc_set_opts(NULL, layout, format, sampleRate, inLayout,
-                                         (AVSampleFormat) af->format, af->sample_rate, 0,
-                                         NULL);
-        if (!mSwrContext) {
-            return error(AVERROR(ENOMEM), "Unable to create audio swr");
-        } else if ((ret = swr_init(mSwrContext)) < 0) {
-            swr_free(&mSwrContext);
-            return error(ret, "Failed to ini audio swr");
-        }
+    // Room for the compensated samples and what the resampler still holds
+    int outCount = (int) ((int64_t) wantedNbSamples * sampleRate / af->sample_rate + 256);
+    int outSize = av_samples_get_buffer_size(NULL, numChannels, outCount, format, 0);
+    if (outSize < 0) {
+        return error(-1, "av_samples_get_buffer_size() failed");
     }
+    if (!(*outBatch = reserveBatch(offset + outSize))) {
+        return error(AVERROR(ENOMEM), "Cannot create audio buffer");
+    }
+    if ((len = mResampler.convert(af, inLayout, wantedNbSamples, *outBatch + offset,
+                                  outCount)) < 0) {
+        return error(len, "Unable to convert audio");
+    }
+    return len * numChannels * av_get_bytes_per_sample(format);
+}
 
-    if (mSwrContext) {
-        // Prepare the buffer
-        float sampleDivision = (float) sampleRate / af->sample_rate;
-        int outCount = (int) (wantedNbSamples * sampleDivision + 256);
-        int outSize = av_samples_get_buffer_size(NULL, numChannels, outCount, format, 0);
-        if (mBufferSize < outSize) {
-            if (outSize < 0) {
-                return error(-1, "av_samples_get_buffer_size() failed");
-            }
-            if (wantedNbSamples != af->nb_samples) {
-                if (swr_set_compensation(mSwrContext,
-                                         (int) ((wantedNbSamples - af->nb_samples) *
-                                                sampleDivision),
-                                         (int) (wantedNbSamples * sampleDivision)) < 0) {
-                    return error(-1, "swr_set_compensation() failed");
-                }
-            }
-            av_fast_malloc(&mAudioBuffer, &mBufferSize, (size_t) outSize);
-        }
-        if (mAudioBuffer == NULL) {
-            return error(AVERROR(ENOMEM), "Cannot create audio buffer");
-        }
-        if ((len = swr_convert(mSwrContext, &mAudioBuffer, outCount,
-                               (const uint8_t **) af->data, af->nb_samples)) < 0) {
-            return error(-1, "swr_convert() failed");
-        }
-        if (len == outCount) {
-            __android_log_print(ANDROID_LOG_WARN, sTag, "audio buffer is probably too small");
-            if (swr_init(mSwrContext) < 0) {
-                swr_free(&mSwrContext);
-            }
-        }
-        *out = mAudioBuffer;
-        size = len * numChannels * av_get_bytes_per_sample(format);
-    } else {
-        *out = af->data[0];
-        size = av_samples_get_buffer_size(NULL, af->channels, af->nb_samples,
-                                          (AVSampleFormat) af->format, 1);
+uint8_t* AudioStream::reserveBatch(int size) {
+    // Decode straight into the renderer's memory when it has some
+    uint8_t* buffer = mAudioRenderer->getBuffer(size);
+    if (!buffer && (buffer = (uint8_t*) av_fast_realloc(mAudioBuffer, &mBufferSize,
+                                                        (size_t) size))) {
+        mAudioBuffer = buffer;
     }
-    return size;
+    return buffer;
 }
 
 int AudioStream::syncClocks(AVFrame* frame) {
     int numSamples = frame->nb_samples;
     int wantedSamples = numSamples;
-    if (getMasterClock() != getClock()) {
+
+    // Compressed audio cannot be stretched
+    if (getMasterClock() != getClock() && !mPassthrough) {
         double diff, avgDiff;
         int minNumSamples, maxNumSamples;
         double diffThreshold = (double) numSamples / frame->sample_rate;
@@ -331,7 +464,8 @@ int AudioStream::syncClocks(AVFrame* frame) {
                 avgDiff = mDiffComputation * (1.0 - mDiffAvgCoef);
 
                 if (fabs(avgDiff) >= diffThreshold) {
-                    wantedSamples = numSamples + (int) (diff * mAudioRenderer->sampleRate());
+                    wantedSamples = numSamples
+                                    + (int) (diff / mPlaybackSpeed * mAudioRenderer->sampleRate());
                     minNumSamples = ((numSamples * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100));
                     maxNumSamples = ((numSamples * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100));
                     wantedSamples = av_clip(wantedSamples, minNumSamples, maxNumSamples);
@@ -353,9 +487,13 @@ int AudioStream::syncClocks(AVFrame* frame) {
 }
 
 void AudioStream::updateClock(Frame *frame, double time) {
+    updateClock(frame->pts(), frame->serial(), time);
+}
+
+void AudioStream::updateClock(double pts, intptr_t serial, double time) {
     std::lock_guard<std::mutex> lk(mQueue->getMutex());
-    if (!isnan(frame->pts())) {
-        getClock()->setTimeAt(frame->pts(), time, frame->serial());
+    if (!isnan(pts)) {
+        getClock()->setTimeAt(pts, time, serial);
         getExternalClock()->syncToClock(getClock());
         mAudioRenderer->updateLatency(mLatencyInvalidated);
         mLatencyInvalidated = false;
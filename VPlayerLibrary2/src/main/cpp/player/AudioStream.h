@@ -1,10 +1,9 @@
 #ifndef AUDIOSTREAM_H
 #define AUDIOSTREAM_H
 
-extern "C" {
-#include <libswresample/swresample.h>
-}
 #include "AVComponentStream.h"
+#include "AudioResampler.h"
+#include "AudioTempoFilter.h"
 #include "IAudioRenderer.h"
 
 class AudioStream : public AVComponentStream {
@@ -13,8 +12,15 @@ public:
     virtual ~AudioStream();
 
     void setPaused(bool paused) override;
+    void setPlaybackSpeed(double speed) override;
 
     void setMute(bool mute);
+
+    /**
+     * Filter quality when the audio has to be resampled
+     * @param quality 0 fastest, 1 default, 2 best
+     */
+    void setResampleQuality(int quality);
     void invalidateLatency();
     double getLatency();
 
@@ -22,6 +28,8 @@ protected:
     int onRenderThread() override;
 
     int onProcessThread() override;
+    void onReceiveDecodingFrame(void *frame, int *outRetCode) override;
+    void onDecodeFrame(void* frame, AVPacket* pkt, int* outRetCode) override;
     void onAVFrameReceived(AVFrame *frame) override;
     void onDecodeFlushBuffers() override;
     AVDictionary* getPropertiesOfStream(AVCodecContext*, AVStream*, AVCodec*) override;
@@ -31,9 +39,13 @@ protected:
     int64_t mNextPts;
     AVRational mNextPtsTb;
 private:
-    int decodeAudioFrame(AVFrame* frame, int wantedNumSamples, uint8_t **out);
+    int addToBatch(AVFrame* frame, double pts, intptr_t serial, double time);
+    int getPassthroughSamples(AVPacket* pkt);
+    int decodeAudioFrame(AVFrame* frame, int wantedNumSamples, int offset, uint8_t **outBatch);
+    uint8_t* reserveBatch(int size);
     int syncClocks(AVFrame* frame);
     void updateClock(Frame *frame, double time);
+    void updateClock(double pts, intptr_t serial, double time);
 
     IAudioRenderer* mAudioRenderer;
     bool mIsMuted;
@@ -41,10 +53,30 @@ private:
     bool mLatencyInvalidated;
     bool mPlaybackStateChanged;
 
-    struct SwrContext* mSwrContext;
+    AudioResampler mResampler;
     uint8_t* mAudioBuffer;
     unsigned int mBufferSize;
 
+    // Audio of consecutive frames collected to write at once, the clock is set from the first one
+    uint8_t* mBatch;
+    int mBatchSize;
+    int mBatchSamples;
+    double mBatchPts;
+    double mBatchStart;
+    intptr_t mBatchSerial;
+
+    // Compressed packets are sent to the renderer undecoded, one frame each
+    bool mPassthrough;
+    AVPacket mPassthroughPkt;
+    bool mPassthroughPending;
+
+    // Time stretching for playback speeds other than 1
+    AudioTempoFilter mTempoFilter;
+    AVFrame* mTempoFrame;
+    double mTempoSpeed;
+    double mTempoPts;
+    intptr_t mTempoSerial;
+
     // Computation variables
     double mDiffComputation;
     double mDiffAvgCoef;
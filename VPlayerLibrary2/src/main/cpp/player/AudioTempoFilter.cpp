@@ -0,0 +1,115 @@
+#include "AudioTempoFilter.h"
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+
+// Range of a single atempo filter, larger changes chain several of them
+#define ATEMPO_MIN 0.5
+#define ATEMPO_MAX 2.0
+
+static const char* sTag = "AudioTempoFilter";
+
+AudioTempoFilter::AudioTempoFilter() :
+        mGraph(NULL),
+        mSrcContext(NULL),
+        mSinkContext(NULL),
+        mSpeed(1),
+        mFormat(AV_SAMPLE_FMT_NONE),
+        mSampleRate(0),
+        mChannels(0),
+        mChannelLayout(0) {
+}
+
+AudioTempoFilter::~AudioTempoFilter() {
+    release();
+}
+
+int AudioTempoFilter::sendFrame(AVFrame *frame, double speed) {
+    int ret;
+    if (!mGraph || speed != mSpeed || frame->format != mFormat
+            || frame->sample_rate != mSampleRate || frame->channels != mChannels
+            || frame->channel_layout != mChannelLayout) {
+        if ((ret = configure(frame, speed)) < 0) {
+            release();
+            return ret;
+        }
+    }
+    return av_buffersrc_write_frame(mSrcContext, frame);
+}
+
+int AudioTempoFilter::receiveFrame(AVFrame *frame) {
+    if (!mGraph) {
+        return AVERROR(EAGAIN);
+    }
+    return av_buffersink_get_frame(mSinkContext, frame);
+}
+
+void AudioTempoFilter::flush() {
+    // Built again with the next frame
+    release();
+}
+
+int AudioTempoFilter::configure(AVFrame *frame, double speed) {
+    int ret;
+    char args[256];
+    release();
+    if (!(mGraph = avfilter_graph_alloc())) {
+        return AVERROR(ENOMEM);
+    }
+
+    const uint64_t layout = frame->channel_layout
+                            ? frame->channel_layout
+                            : (uint64_t) av_get_default_channel_layout(frame->channels);
+    snprintf(args, sizeof(args),
+             "sample_rate=%d:sample_fmt=%s:channels=%d:channel_layout=0x%" PRIx64 ":time_base=1/%d",
+             frame->sample_rate, av_get_sample_fmt_name((AVSampleFormat) frame->format),
+             frame->channels, layout, frame->sample_rate);
+    if ((ret = avfilter_graph_create_filter(&mSrcContext, avfilter_get_by_name("abuffer"), "in",
+                                            args, NULL, mGraph)) < 0
+            || (ret = avfilter_graph_create_filter(&mSinkContext,
+                                                   avfilter_get_by_name("abuffersink"), "out",
+                                                   NULL, NULL, mGraph)) < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot create audio buffer filters");
+        return ret;
+    }
+
+    // Each atempo only goes from half to double speed, chain them for the rest
+    AVFilterContext* last = mSrcContext;
+    double remaining = speed;
+    for (int i = 0; fabs(remaining - 1) > 1e-6; i++) {
+        const double tempo = av_clipd(remaining, ATEMPO_MIN, ATEMPO_MAX);
+        AVFilterContext* tempoContext;
+        char name[16];
+        snprintf(name, sizeof(name), "atempo%d", i);
+        snprintf(args, sizeof(args), "%f", tempo);
+        if ((ret = avfilter_graph_create_filter(&tempoContext, avfilter_get_by_name("atempo"),
+                                                name, args, NULL, mGraph)) < 0
+                || (ret = avfilter_link(last, 0, tempoContext, 0)) < 0) {
+            __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot create atempo filter");
+            return ret;
+        }
+        last = tempoContext;
+        remaining /= tempo;
+    }
+    if ((ret = avfilter_link(last, 0, mSinkContext, 0)) < 0
+            || (ret = avfilter_graph_config(mGraph, NULL)) < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot configure audio tempo filter graph");
+        return ret;
+    }
+
+    __android_log_print(ANDROID_LOG_VERBOSE, sTag, "Audio tempo filter at %.2fx", speed);
+    mSpeed = speed;
+    mFormat = frame->format;
+    mSampleRate = frame->sample_rate;
+    mChannels = frame->channels;
+    mChannelLayout = frame->channel_layout;
+    return 0;
+}
+
+void AudioTempoFilter::release() {
+    if (mGraph) {
+        avfilter_graph_free(&mGraph);
+    }
+    mSrcContext = NULL;
+    mSinkContext = NULL;
+}
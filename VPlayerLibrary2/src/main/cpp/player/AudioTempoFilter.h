@@ -0,0 +1,51 @@
+#ifndef AUDIOTEMPOFILTER_H
+#define AUDIOTEMPOFILTER_H
+
+extern "C" {
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersrc.h>
+#include <libavfilter/buffersink.h>
+}
+#include <android/log.h>
+
+/**
+ * Changes the tempo of decoded audio without changing its pitch using FFmpeg's atempo filter, for
+ * playback speeds other than normal. The filter holds on to some audio, so a frame sent may
+ * return nothing yet or several frames later. The graph is rebuilt when the speed or the format
+ * of the audio changes.
+ */
+class AudioTempoFilter {
+public:
+    AudioTempoFilter();
+    ~AudioTempoFilter();
+
+    /**
+     * Send a decoded frame to be stretched, the frame is not modified
+     * @return 0 on success or negative error
+     */
+    int sendFrame(AVFrame* frame, double speed);
+
+    /**
+     * Take the next frame stretched to the speed
+     * @return 0 when a frame was returned, AVERROR(EAGAIN) if it needs more audio
+     */
+    int receiveFrame(AVFrame* frame);
+
+    // Drop the audio held in the filter, used when the audio jumps
+    void flush();
+
+private:
+    int configure(AVFrame* frame, double speed);
+    void release();
+
+    AVFilterGraph* mGraph;
+    AVFilterContext* mSrcContext;
+    AVFilterContext* mSinkContext;
+    double mSpeed;
+    int mFormat;
+    int mSampleRate;
+    int mChannels;
+    uint64_t mChannelLayout;
+};
+
+#endif //AUDIOTEMPOFILTER_H
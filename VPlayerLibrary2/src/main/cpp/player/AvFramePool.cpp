@@ -1,10 +1,15 @@
 #include "AvFramePool.h"
 
+#define FRAME_ALIGNMENT 16
+
 static const char* sTag = "AvFramePool";
 
 AvFramePool::AvFramePool() :
         mFrameNextIndex(0),
-        mFrameEmptyIndex(0) {
+        mFrameEmptyIndex(0),
+        mWidth(0),
+        mHeight(0),
+        mFormat(AV_PIX_FMT_NONE) {
 }
 
 AvFramePool::~AvFramePool() {
@@ -13,6 +18,9 @@ AvFramePool::~AvFramePool() {
 
 int AvFramePool::resize(size_t size, int width, int height, AVPixelFormat format) {
     reset();
+    mWidth = width;
+    mHeight = height;
+    mFormat = format;
     int ret = -1;
     if (size > 0) {
         for (int i = 0; i < size + 1; i++) {
@@ -21,38 +29,88 @@ int AvFramePool::resize(size_t size, int width, int height, AVPixelFormat format
                 __android_log_print(ANDROID_LOG_ERROR, sTag, "Unable to allocate frame in pool");
                 return AVERROR(ENOMEM);
             }
-            if ((ret = av_image_alloc(frame->data, frame->linesize,width, height, format, 16)) < 0) {
+            mFrames.push_back(frame);
+            mFrameCapacities.push_back(0);
+        }
+
+        // If the size is not known yet, frames are allocated when acquired
+        if (width <= 0 || height <= 0 || format == AV_PIX_FMT_NONE) {
+            return 0;
+        }
+        for (size_t i = 0; i < mFrames.size(); i++) {
+            if ((ret = ensureFrameBuffer(i)) < 0) {
                 __android_log_print(ANDROID_LOG_ERROR, sTag,
                                     "Unable to allocate frame data in pool");
-                av_frame_free(&frame);
                 return ret;
             }
-            mFrames.push_back(frame);
         }
-        mFrameNextIndex = 0;
-        mFrameEmptyIndex = 0;
     }
+    return ret;
+}
+
+void AvFramePool::setFrameFormat(int width, int height, AVPixelFormat format) {
     mWidth = width;
     mHeight = height;
     mFormat = format;
-    return ret;
 }
 
 AVFrame *AvFramePool::acquire() {
-    AVFrame* frame = mFrames[mFrameNextIndex];
-    frame->width = mWidth;
-    frame->height = mHeight;
-    frame->format = mFormat;
+    if (mFrames.empty() || mWidth <= 0 || mHeight <= 0 || mFormat == AV_PIX_FMT_NONE) {
+        return NULL;
+    }
+    const size_t index = (size_t) mFrameNextIndex;
     if (++mFrameNextIndex >= mFrames.size()) {
         mFrameNextIndex = 0;
     }
+    AVFrame* frame = mFrames[index];
+    if (frame->width != mWidth || frame->height != mHeight || frame->format != mFormat) {
+        if (ensureFrameBuffer(index) < 0) {
+            __android_log_print(ANDROID_LOG_ERROR, sTag, "Unable to fit frame to new format "
+                    "%dx%d", mWidth, mHeight);
+            return NULL;
+        }
+    }
     return frame;
 }
 
+int AvFramePool::ensureFrameBuffer(size_t index) {
+    AVFrame* frame = mFrames[index];
+    int ret;
+    int size = av_image_get_buffer_size(mFormat, mWidth, mHeight, FRAME_ALIGNMENT);
+    if (size < 0) {
+        return size;
+    }
+    if (size > mFrameCapacities[index]) {
+        // Buffer is too small for this geometry, reallocate it
+        av_freep(&frame->data[0]);
+        mFrameCapacities[index] = 0;
+        if ((ret = av_image_alloc(frame->data, frame->linesize, mWidth, mHeight, mFormat,
+                                  FRAME_ALIGNMENT)) < 0) {
+            return ret;
+        }
+        mFrameCapacities[index] = ret;
+    } else {
+        // Buffer is large enough, only the plane layout needs to be updated
+        uint8_t* buffer = frame->data[0];
+        if ((ret = av_image_fill_arrays(frame->data, frame->linesize, buffer, mFormat, mWidth,
+                                        mHeight, FRAME_ALIGNMENT)) < 0) {
+            return ret;
+        }
+    }
+    frame->width = mWidth;
+    frame->height = mHeight;
+    frame->format = mFormat;
+    return 0;
+}
+
 void AvFramePool::reset() {
     for (int i = 0; i < mFrames.size(); i++) {
-        av_frame_unref(mFrames[i]);
-        av_freep(mFrames[i]);
+        // Buffers are not reference counted, free the image data before the frame itself
+        av_freep(&mFrames[i]->data[0]);
+        av_frame_free(&mFrames[i]);
     }
     mFrames.clear();
+    mFrameCapacities.clear();
+    mFrameNextIndex = 0;
+    mFrameEmptyIndex = 0;
 }
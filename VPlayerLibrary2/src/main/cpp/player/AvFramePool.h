@@ -16,12 +16,29 @@ public:
 
     int resize(size_t size, int width, int height, enum AVPixelFormat format);
 
+    /**
+     * Changes the geometry of the frames acquired from now on. Buffers are not touched here
+     * because queued frames may still be rendering, each frame is adjusted when it is acquired
+     * and only reallocated if its buffer is too small.
+     */
+    void setFrameFormat(int width, int height, enum AVPixelFormat format);
+
     AVFrame* acquire();
 
+    int width() {
+        return mWidth;
+    }
+
+    int height() {
+        return mHeight;
+    }
+
 private:
     void reset();
+    int ensureFrameBuffer(size_t index);
 
     std::vector<AVFrame*> mFrames;
+    std::vector<int> mFrameCapacities;
     int mFrameNextIndex;
     int mFrameEmptyIndex;
 
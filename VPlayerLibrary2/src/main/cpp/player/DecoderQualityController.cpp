@@ -0,0 +1,131 @@
+#include "DecoderQualityController.h"
+
+// Weight of the previous average when adding a new lateness measurement
+#define LATENESS_AVG_COEF 0.9
+
+// Minimum number of measurements before the average is trusted
+#define LATENESS_MIN_SAMPLES 10
+
+// Decoded frames are queued ahead of the clock, when they are late on average the decoder is
+// falling behind; they have to be this early on average before quality is raised again
+#define DEGRADE_LATENESS_SEC 0.0
+#define RESTORE_LATENESS_SEC -0.06
+
+// Frames to wait after a level change before judging it, lets the decoder and average settle
+#define CHANGE_COOLDOWN_FRAMES 15
+
+// Number of consecutive caught up frames needed to restore one level
+#define RESTORE_FRAMES 90
+
+// Each late drop on the render thread counts as this much lateness
+#define LATE_DROP_PENALTY_SEC 0.04
+
+static const char* sTag = "DecoderQualityController";
+
+typedef struct {
+    enum AVDiscard skipLoopFilter;
+    enum AVDiscard skipIdct;
+    enum AVDiscard skipFrame;
+} QualityLevel;
+
+static const QualityLevel sQualityLevels[] = {
+        // Full quality
+        { AVDISCARD_DEFAULT, AVDISCARD_DEFAULT, AVDISCARD_DEFAULT },
+        // Skip deblocking of frames that are not referenced
+        { AVDISCARD_NONREF, AVDISCARD_DEFAULT, AVDISCARD_DEFAULT },
+        // Skip all deblocking and idct of frames that are not referenced
+        { AVDISCARD_ALL, AVDISCARD_NONREF, AVDISCARD_DEFAULT },
+        // Do not decode frames that are not referenced
+        { AVDISCARD_ALL, AVDISCARD_BIDIR, AVDISCARD_NONREF },
+        // Do not decode any bidirectional frames
+        { AVDISCARD_ALL, AVDISCARD_BIDIR, AVDISCARD_BIDIR },
+};
+static const int sNumQualityLevels = sizeof(sQualityLevels) / sizeof(sQualityLevels[0]);
+
+DecoderQualityController::DecoderQualityController() :
+        mAvgLateness(0),
+        mNumSamples(0),
+        mFramesSinceChange(0),
+        mFramesCaughtUp(0),
+        mLevel(0),
+        mAppliedLevel(0),
+        mMinLevel(0),
+        mPendingLateDrops(0) {
+}
+
+DecoderQualityController::~DecoderQualityController() {
+}
+
+void DecoderQualityController::reset() {
+    flush();
+    mLevel = 0;
+    mAppliedLevel = 0;
+}
+
+void DecoderQualityController::flush() {
+    mAvgLateness = 0;
+    mNumSamples = 0;
+    mFramesSinceChange = 0;
+    mFramesCaughtUp = 0;
+    mPendingLateDrops = 0;
+}
+
+void DecoderQualityController::addLateness(double lateSec) {
+    // Late drops from the render thread mean frames arrived too late to be shown at all
+    int lateDrops = mPendingLateDrops.exchange(0);
+    if (lateDrops > 0) {
+        lateSec = FFMAX(lateSec, 0) + lateDrops * LATE_DROP_PENALTY_SEC;
+    }
+
+    mAvgLateness = mNumSamples == 0 ? lateSec
+            : LATENESS_AVG_COEF * mAvgLateness + (1.0 - LATENESS_AVG_COEF) * lateSec;
+    mNumSamples++;
+    mFramesSinceChange++;
+    if (mNumSamples < LATENESS_MIN_SAMPLES || mFramesSinceChange < CHANGE_COOLDOWN_FRAMES) {
+        return;
+    }
+
+    if (mAvgLateness > DEGRADE_LATENESS_SEC) {
+        mFramesCaughtUp = 0;
+        if (mLevel < sNumQualityLevels - 1) {
+            setLevel(mLevel + 1);
+        }
+    } else if (mAvgLateness < RESTORE_LATENESS_SEC) {
+        if (++mFramesCaughtUp >= RESTORE_FRAMES && mLevel > mMinLevel) {
+            setLevel(mLevel - 1);
+        }
+    } else {
+        mFramesCaughtUp = 0;
+    }
+}
+
+void DecoderQualityController::onLateFrameDropped() {
+    mPendingLateDrops++;
+}
+
+void DecoderQualityController::setMinLevel(int level) {
+    mMinLevel = av_clip(level, 0, sNumQualityLevels - 1);
+}
+
+bool DecoderQualityController::apply(AVCodecContext *context) {
+    if (mLevel < mMinLevel) {
+        setLevel(mMinLevel);
+    }
+    if (mLevel == mAppliedLevel || context == NULL) {
+        return false;
+    }
+    const QualityLevel& level = sQualityLevels[mLevel];
+    context->skip_loop_filter = level.skipLoopFilter;
+    context->skip_idct = level.skipIdct;
+    context->skip_frame = level.skipFrame;
+    mAppliedLevel = mLevel;
+    return true;
+}
+
+void DecoderQualityController::setLevel(int level) {
+    __android_log_print(ANDROID_LOG_DEBUG, sTag, "Decoding quality level %d -> %d (avg late %lf)",
+                        mLevel, level, mAvgLateness);
+    mLevel = level;
+    mFramesSinceChange = 0;
+    mFramesCaughtUp = 0;
+}
@@ -0,0 +1,63 @@
+#ifndef DECODERQUALITYCONTROLLER_H
+#define DECODERQUALITYCONTROLLER_H
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+#include <atomic>
+#include <android/log.h>
+
+/**
+ * Lowers the decoding quality (skip loop filter, idct and non-reference frames) when the decoder
+ * cannot keep up with the master clock and restores full quality once it has caught up.
+ * Lateness is reported from the decoding thread, late drops can be reported from any thread.
+ */
+class DecoderQualityController {
+public:
+    DecoderQualityController();
+    ~DecoderQualityController();
+
+    void reset();
+
+    // Clear the measurements but keep the current level, used after seeking
+    void flush();
+
+    /**
+     * Add a measurement of how late a decoded frame is compared to the master clock
+     * @param lateSec seconds the frame is behind the clock, negative if it is early
+     */
+    void addLateness(double lateSec);
+
+    void onLateFrameDropped();
+
+    /**
+     * Never go above this quality, used when playing faster since that decodes more frames per
+     * second, applied with the next apply()
+     * @param level 0 for full quality
+     */
+    void setMinLevel(int level);
+
+    /**
+     * Apply the current quality level to the codec, must be called on the decoding thread
+     * @return true if the codec settings changed
+     */
+    bool apply(AVCodecContext* context);
+
+    int level() {
+        return mLevel;
+    }
+
+private:
+    void setLevel(int level);
+
+    double mAvgLateness;
+    int mNumSamples;
+    int mFramesSinceChange;
+    int mFramesCaughtUp;
+    int mLevel;
+    int mAppliedLevel;
+    std::atomic<int> mMinLevel;
+    std::atomic<int> mPendingLateDrops;
+};
+
+#endif //DECODERQUALITYCONTROLLER_H
@@ -0,0 +1,34 @@
+#include "DecoderThreadBudget.h"
+
+// Cores left for the audio decoder, read thread and render threads while video is decoding
+#define RESERVED_CORES 1
+#define MIN_VIDEO_THREADS 2
+// FFmpeg warns when using more than 16 threads, the gain is negligible after that
+#define MAX_VIDEO_THREADS 16
+
+static const char* sTag = "DecoderThreadBudget";
+
+void DecoderThreadBudget::configure(AVCodecContext *context, enum AVMediaType type,
+                                    bool lowLatency) {
+    context->thread_count = threadsForType(type);
+    if (type == AVMEDIA_TYPE_VIDEO) {
+        context->thread_type = lowLatency ? FF_THREAD_SLICE : FF_THREAD_FRAME | FF_THREAD_SLICE;
+    } else {
+        context->thread_type = FF_THREAD_SLICE;
+    }
+    __android_log_print(ANDROID_LOG_VERBOSE, sTag, "%s decoder uses %d threads (%s)",
+                        av_get_media_type_string(type), context->thread_count,
+                        context->thread_type & FF_THREAD_FRAME ? "frame" : "slice");
+}
+
+int DecoderThreadBudget::threadsForType(enum AVMediaType type) {
+    if (type == AVMEDIA_TYPE_VIDEO) {
+        return FFMIN(FFMAX(numCores() - RESERVED_CORES, MIN_VIDEO_THREADS), MAX_VIDEO_THREADS);
+    }
+    return 1;
+}
+
+int DecoderThreadBudget::numCores() {
+    // Can return 0 if it cannot be detected
+    return FFMAX((int) std::thread::hardware_concurrency(), 1);
+}
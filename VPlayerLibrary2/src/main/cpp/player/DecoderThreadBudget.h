@@ -0,0 +1,31 @@
+#ifndef DECODERTHREADBUDGET_H
+#define DECODERTHREADBUDGET_H
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+#include <thread>
+#include <android/log.h>
+
+/**
+ * Splits the cores between the decoders of each stream so they do not oversubscribe the cpu.
+ * Video gets most of the cores, audio and subtitles only need a single thread each.
+ */
+class DecoderThreadBudget {
+public:
+    /**
+     * Sets the thread count and threading type of the codec, must be called before opening it
+     * @param context codec to configure
+     * @param type media type of the stream
+     * @param lowLatency use slice threading because frame threading delays each frame by a
+     *                   frame per thread
+     */
+    static void configure(AVCodecContext* context, enum AVMediaType type, bool lowLatency);
+
+    static int threadsForType(enum AVMediaType type);
+
+private:
+    static int numCores();
+};
+
+#endif //DECODERTHREADBUDGET_H
@@ -5,7 +5,21 @@
 
 class IAudioRenderer {
 public:
-    virtual int write(uint8_t *data, int len) = 0;
+    /**
+     * Get memory to decode audio into that write() can pass on without copying, growing it keeps
+     * what was already decoded into it
+     * @param size minimum number of bytes needed
+     * @return memory owned by the renderer or NULL if it has none, write() copies from elsewhere.
+     *         It stays valid until the next getBuffer() or the renderer is deleted
+     */
+    virtual uint8_t* getBuffer(int size) = 0;
+
+    /**
+     * Write audio, blocking until there is room for some of it
+     * @param numSamples samples per channel the data plays for, compressed audio is timed by it
+     * @return bytes written or negative error
+     */
+    virtual int write(uint8_t *data, int len, int numSamples) = 0;
     virtual int pause() = 0;
     virtual int play() = 0;
     virtual int flush() = 0;
@@ -17,6 +31,12 @@ public:
     virtual int64_t layout() = 0;
     virtual enum AVSampleFormat format() = 0;
 
+    /**
+     * Whether the sink takes the compressed stream (AC3, EAC3 or DTS) instead of decoded audio,
+     * packets are written as they are and format() is AV_SAMPLE_FMT_NONE
+     */
+    virtual bool isPassthrough() = 0;
+
     /**
      * Get the audio latency when writing to be displayed in seconds
      * @return latency in seconds
@@ -44,7 +44,8 @@ public:
 
     virtual void onPlaybackChanged(bool playing) = 0;
 
-    virtual IAudioRenderer* createAudioRenderer(AVCodecContext *context) = 0;
+    // Passthrough asks the sink to take AC3, EAC3 and DTS undecoded, it may not support it
+    virtual IAudioRenderer* createAudioRenderer(AVCodecContext *context, bool passthrough) = 0;
 
     virtual bool onThreadStart() = 0;
 
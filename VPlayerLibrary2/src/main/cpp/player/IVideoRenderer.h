@@ -6,11 +6,14 @@ extern "C" {
 }
 
 #include <ass/ass.h>
+#include "SubtitleFrameQueue.h"
 
 class IVideoRenderer {
 public:
 virtual bool writeSubtitlesSeparately() = 0;
-virtual int writeFrame(AVFrame* videoFrame, AVFrame* subtitleFrame) = 0;
+// Only subtitleDamage of the subtitle frame changed since the last one, write all if NULL
+virtual int writeFrame(AVFrame* videoFrame, AVFrame* subtitleFrame,
+                       const SubtitleFrameQueue::Rect* subtitleDamage) = 0;
 virtual int renderFrame() = 0;
 };
 
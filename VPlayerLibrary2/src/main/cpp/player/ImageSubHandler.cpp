@@ -1,4 +1,5 @@
 #include "ImageSubHandler.h"
+#include "blend.h"
 
 extern "C" {
 #include <libavutil/imgutils.h>
@@ -7,15 +8,36 @@ extern "C" {
 
 #define SUBPICTURE_QUEUE_SIZE 16
 
+// Converted subtitles kept around for seeking back and changing the frame size
+#define MAX_FRAME_CACHE_BYTES (24 * 1024 * 1024)
+
 static const char* sTag = "ImageSubHandler";
-static const double CACHE_FRAME_TIMEOUT_SEC = 20.0;
+
+// FNV-1a of the visible indexed pixels and the palette of a subtitle rect
+static uint64_t hashRectContent(const AVSubtitleRect* rect) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int y = 0; y < rect->h; y++) {
+        const uint8_t* row = rect->data[0] + (size_t) y * rect->linesize[0];
+        for (int x = 0; x < rect->w; x++) {
+            hash = (hash ^ row[x]) * 0x100000001b3ULL;
+        }
+    }
+    if (rect->data[1]) {
+        for (int i = 0; i < rect->nb_colors * 4; i++) {
+            hash = (hash ^ rect->data[1][i]) * 0x100000001b3ULL;
+        }
+    }
+    return hash != 0 ? hash : 1;
+}
 
 ImageSubHandler::ImageSubHandler(AVCodecID codecID) :
         SubtitleHandlerBase(codecID),
         mSwsContext(NULL),
         mQueue(NULL),
+        mFrameCache(MAX_FRAME_CACHE_BYTES),
         mCodecWidth(0),
-        mInvalidate(false) {
+        mInvalidate(false),
+        mDrawnBounds({0, 0, 0, 0}) {
 }
 
 ImageSubHandler::~ImageSubHandler() {
@@ -23,18 +45,20 @@ ImageSubHandler::~ImageSubHandler() {
         delete mQueue;
         mQueue = NULL;
     }
-    for (int i = 0; i < mFrameCache.size(); ++i) {
-        av_freep(mFrameCache[i].frame);
-    }
     if (mSwsContext) {
         sws_freeContext(mSwsContext);
         mSwsContext = NULL;
     }
 }
 
-int ImageSubHandler::open(AVCodecContext *cContext, AVFormatContext *fContext) {
+int ImageSubHandler::open(AVCodecContext *cContext, AVFormatContext *fContext,
+                          int /* streamIndex */) {
     mCodecWidth = cContext->width;
     mInvalidate = true;
+    mDrawnBounds = {0, 0, 0, 0};
+
+    // Cached images belong to the previous stream
+    mFrameCache.clear();
 
     if (mQueue) {
         delete mQueue;
@@ -49,7 +73,9 @@ void ImageSubHandler::abort() {
     }
 }
 
-int ImageSubHandler::blendToFrame(double pts, AVFrame *vFrame, intptr_t pktSerial, bool force) {
+int ImageSubHandler::blendToFrame(double pts, AVFrame *vFrame, intptr_t pktSerial, bool force,
+                                  std::vector<SubtitleFrameQueue::Rect>* outDirtyRects,
+                                  SubtitleFrameQueue::Rect* outDamage) {
     int ret = 0;
     while (mQueue->getNumRemaining() > 0) {
         Frame* sp = mQueue->peekFirst(), *sp2 = NULL;
@@ -72,53 +98,32 @@ int ImageSubHandler::blendToFrame(double pts, AVFrame *vFrame, intptr_t pktSeria
             if (pts >= sp->startPts() && (mInvalidate || force)) {
                 AVSubtitle* sub = sp->subtitle();
                 if (sub->format == 0 /* graphics */) {
-                    if (sub->num_rects == 0 && mInvalidate) {
-                        // No subtitles shown
-                        mInvalidate = false;
-                        ret = 1;
-                    }
-
-                    // Blend each subtitle rect to the frame
+                    // Blend each subtitle rect to the frame, converted only if not cached
+                    SubtitleFrameQueue::Rect bounds = {0, 0, 0, 0};
                     for (int i = 0; i < sub->num_rects; i++) {
-                        // Add a new frame cache that is needed to hold subtitles
-                        if (mFrameCache.size() <= i) {
-                            AVFrame *f = av_frame_alloc();
-                            if (!f) {
-                                __android_log_print(ANDROID_LOG_ERROR, sTag,
-                                                    "Unable to allocate temporary avframe");
-                                return AVERROR(ENOMEM);
-                            }
-                            mFrameCache.push_back({0, 0, f, 0});
-                        }
-                        FrameCache& cache = mFrameCache[i];
-                        AVFrame *tmpFrame = cache.frame;
-                        cache.lastUsed = pts;
-
-                        // Subtitle needs to be reconverted and resized to cached image
-                        if (mInvalidate) {
-                            if ((ret = prepareSubFrame(sub->rects[i], cache, vFrame->width,
-                                                       vFrame->height)) < 0) {
-                                return ret;
-                            }
-
-                            // Delete any frames unused except the first after the cache timeout
-                            for (long j = mFrameCache.size() - 1; j >= 1; --j) {
-                                if (pts - mFrameCache[j].lastUsed > CACHE_FRAME_TIMEOUT_SEC) {
-                                    av_freep(mFrameCache[j].frame);
-                                    mFrameCache.pop_back();
-                                } else {
-                                    break;
-                                }
-                            }
-                            ret = 1;
+                        SubtitleBitmapCache::Entry* entry;
+                        if ((ret = getSubFrame(sub->pts, sub->rects[i], vFrame->width,
+                                               vFrame->height, &entry)) < 0) {
+                            return ret;
                         }
-                        blendFrames(vFrame, tmpFrame, cache.x, cache.y);
-                        if (force) {
-                            // Re-render this frame if forced
-                            ret = 1;
+                        blendFrames(vFrame, entry->frame, entry->x, entry->y);
+                        const SubtitleFrameQueue::Rect drawn = {entry->x, entry->y,
+                                                                entry->frame->width,
+                                                                entry->frame->height};
+                        if (outDirtyRects) {
+                            outDirtyRects->push_back(drawn);
                         }
+                        bounds.unite(drawn);
                     }
+
+                    // Whole subtitles change at once, redraw where the last and this one are
+                    if (outDamage) {
+                        *outDamage = bounds;
+                        outDamage->unite(mDrawnBounds);
+                    }
+                    mDrawnBounds = bounds;
                     mInvalidate = false;
+                    ret = 1;
                 } else {
                     __android_log_print(ANDROID_LOG_WARN, sTag,
                                         "Cannot render subtitle with type %d", sub->format);
@@ -134,6 +139,11 @@ void ImageSubHandler::setDefaultFont(const char *fontPath, const char *fontFamil
     // Not used
 }
 
+void ImageSubHandler::setCacheBudget(int megabytes) {
+    mFrameCache.setMaxBytes(megabytes > 0 ? (size_t) megabytes * 1024 * 1024
+                                          : MAX_FRAME_CACHE_BYTES);
+}
+
 bool ImageSubHandler::handleDecodedSubtitle(AVSubtitle *subtitle, intptr_t pktSerial) {
     Frame* sp;
     if (!(sp = mQueue->peekWritable())) {
@@ -153,52 +163,28 @@ AVSubtitle *ImageSubHandler::getSubtitle() {
 }
 
 void ImageSubHandler::blendFrames(AVFrame *dstFrame, AVFrame *srcFrame, int srcX, int srcY) {
-    uint8_t *dst = dstFrame->data[0] + dstFrame->linesize[0] * srcY + srcX * 4;
-    int dstStride = dstFrame->linesize[0];
-    uint8_t *src = srcFrame->data[0];
-    int srcStride = srcFrame->linesize[0];
-
-    int rect_r, rect_g, rect_b, rect_a;
-    int dest_r, dest_g, dest_b, dest_a;
-    int x2, y2;
-
-    for (y2 = 0; y2 < srcFrame->height; y2++) {
-        uint32_t *dst2 = (uint32_t *) dst;
-        uint32_t *src2 = (uint32_t *) src;
-
-        for (x2 = 0; x2 < srcFrame->width; x2++) {
-            uint32_t *image_pixel = (src2++);
-            uint32_t *pixel = (dst2++);
-
-            // Expand the subtitle pixel
-            rect_a = (image_pixel[0] >> 24) & 0xff;
-            rect_r = (image_pixel[0] >> 16) & 0xff;
-            rect_g = (image_pixel[0] >> 8) & 0xff;
-            rect_b = image_pixel[0] & 0xff;
-
-            dest_a = (pixel[0] >> 24) & 0xff;
-            dest_r = (pixel[0] >> 16) & 0xff;
-            dest_g = (pixel[0] >> 8) & 0xff;
-            dest_b = pixel[0] & 0xff;
-
-            // Pixel blending
-            dest_a = (((dest_a * (0xff - rect_a)) + (rect_a * rect_a)) / 0xff);
-            dest_r = (((dest_r * (0xff - rect_a)) + (rect_r * rect_a)) / 0xff);
-            dest_g = (((dest_g * (0xff - rect_a)) + (rect_g * rect_a)) / 0xff);
-            dest_b = (((dest_b * (0xff - rect_a)) + (rect_b * rect_a)) / 0xff);
-
-            // Write pixel back to frame
-            pixel[0] = (uint32_t) ((dest_a << 24) | (dest_r << 16) | (dest_g << 8) | dest_b);
-        }
-        dst += dstStride;
-        src += srcStride;
+    alphablend::YUVPlanes planes;
+    if (SubtitleStream::getYUVPlanes(dstFrame, &planes)) {
+        alphablend::blendPremultipliedToYUV(planes, srcX, srcY, srcFrame->data[0],
+                                            (size_t) srcFrame->linesize[0], srcFrame->width,
+                                            srcFrame->height);
+        return;
     }
+    uint8_t *dst = dstFrame->data[0] + dstFrame->linesize[0] * srcY + srcX * 4;
+    alphablend::blendPremultiplied(dst, (size_t) dstFrame->linesize[0], srcFrame->data[0],
+                                   (size_t) srcFrame->linesize[0], (size_t) srcFrame->width,
+                                   (size_t) srcFrame->height);
 }
 
 bool ImageSubHandler::areFramesPending() {
     return mQueue != NULL && mQueue->getNumRemaining() > 0;
 }
 
+bool ImageSubHandler::prerender() {
+    // Bitmaps are converted when shown and then cached
+    return false;
+}
+
 void ImageSubHandler::invalidateFrame() {
     mInvalidate = true;
 }
@@ -207,39 +193,70 @@ void ImageSubHandler::flush() {
     // Not used
 }
 
-int ImageSubHandler::prepareSubFrame(AVSubtitleRect* rect, FrameCache& cache, int vWidth,
-                                     int vHeight) {
+int ImageSubHandler::getSubFrame(int64_t pts, AVSubtitleRect *rect, int vWidth, int vHeight,
+                                 SubtitleBitmapCache::Entry **outEntry) {
+    // Subtitles without a pts would all share one entry per position, tell them apart by content
+    const uint64_t contentHash = pts == AV_NOPTS_VALUE ? hashRectContent(rect) : 0;
+    const SubtitleBitmapCache::Key key = {pts, contentHash, rect->x, rect->y, rect->w, rect->h,
+                                          vWidth, vHeight};
+    if ((*outEntry = mFrameCache.get(key)) != NULL) {
+        return 0;
+    }
+
+    // Subtitle needs to be converted and resized to the frame
+    int ret, x, y;
+    AVFrame* tmpFrame;
+    if ((ret = prepareSubFrame(rect, vWidth, vHeight, &x, &y, &tmpFrame)) < 0) {
+        return ret;
+    }
+    *outEntry = mFrameCache.put(key, x, y, tmpFrame);
+    return 0;
+}
+
+int ImageSubHandler::prepareSubFrame(AVSubtitleRect* rect, int vWidth, int vHeight, int* outX,
+                                     int* outY, AVFrame** outFrame) {
     int ret = 0;
-    AVFrame* tmpFrame = cache.frame;
 
     // Calculate the bounds of the resized subtitle image
     const float ratio = (float) vWidth / mCodecWidth;
-    cache.x = av_clip((int) roundf(rect->x * ratio), 0, vWidth);
-    cache.y = av_clip((int) roundf(rect->y * ratio), 0, vHeight);
-    int w = av_clip((int) roundf(rect->w * ratio), 0, vWidth - cache.x);
-    int h = av_clip((int) roundf(rect->h * ratio), 0, vHeight - cache.y);
-
-    // Resize the cached frame if too small
-    if ((w > tmpFrame->width || h > tmpFrame->height)) {
-        if ((ret = av_image_alloc(tmpFrame->data, tmpFrame->linesize, w, h,
-                                  AV_PIX_FMT_BGRA, 1)) < 0) {
-            __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot allocate image");
-            return ret;
-        }
+    const int x = av_clip((int) roundf(rect->x * ratio), 0, vWidth);
+    const int y = av_clip((int) roundf(rect->y * ratio), 0, vHeight);
+    int w = av_clip((int) roundf(rect->w * ratio), 0, vWidth - x);
+    int h = av_clip((int) roundf(rect->h * ratio), 0, vHeight - y);
+
+    AVFrame* tmpFrame = av_frame_alloc();
+    if (!tmpFrame) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag, "Unable to allocate temporary avframe");
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = av_image_alloc(tmpFrame->data, tmpFrame->linesize, w, h, AV_PIX_FMT_BGRA, 1)) < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot allocate image");
+        av_frame_free(&tmpFrame);
+        return ret;
     }
 
     // Resize and convert the color space of the subtitle
     if (!(mSwsContext = sws_getCachedContext(mSwsContext, rect->w, rect->h, AV_PIX_FMT_PAL8, w, h,
                                              AV_PIX_FMT_BGRA, 0, NULL, NULL, NULL))) {
         __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot initialize the conversion context");
-        return AVERROR(EINVAL);
-    }
-    if ((ret = sws_scale(mSwsContext, (const uint8_t *const *) rect->data, rect->linesize, 0,
-                         rect->h, tmpFrame->data, tmpFrame->linesize)) < 0) {
+        ret = AVERROR(EINVAL);
+    } else if ((ret = sws_scale(mSwsContext, (const uint8_t *const *) rect->data, rect->linesize,
+                                0, rect->h, tmpFrame->data, tmpFrame->linesize)) < 0) {
         __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot scale subtitle frame to video");
+    }
+    if (ret < 0) {
+        av_freep(&tmpFrame->data[0]);
+        av_frame_free(&tmpFrame);
         return ret;
     }
+
+    // Premultiply once here so blending to each video frame is cheaper
+    alphablend::premultiply(tmpFrame->data[0], (size_t) tmpFrame->linesize[0], (size_t) w,
+                            (size_t) h);
     tmpFrame->width = w;
     tmpFrame->height = h;
-    return ret;
+    *outX = x;
+    *outY = y;
+    *outFrame = tmpFrame;
+    return 0;
 }
@@ -4,13 +4,14 @@
 #include <vector>
 #include "SubtitleStream.h"
 #include "FrameQueue.h"
+#include "SubtitleBitmapCache.h"
 
 class ImageSubHandler : public SubtitleStream::SubtitleHandlerBase {
 public:
     ImageSubHandler(AVCodecID codecID);
     ~ImageSubHandler();
 
-    int open(AVCodecContext *cContext, AVFormatContext *fContext) override;
+    int open(AVCodecContext *cContext, AVFormatContext *fContext, int streamIndex) override;
 
     void abort() override;
 
@@ -18,32 +19,37 @@ public:
 
     AVSubtitle *getSubtitle() override;
 
-    int blendToFrame(double pts, AVFrame *frame, intptr_t pktSerial, bool force = false) override;
+    int blendToFrame(double pts, AVFrame *frame, intptr_t pktSerial, bool force,
+                     std::vector<SubtitleFrameQueue::Rect>* outDirtyRects,
+                     SubtitleFrameQueue::Rect* outDamage) override;
 
     void setDefaultFont(const char *fontPath, const char *fontFamily) override;
 
+    void setCacheBudget(int megabytes) override;
+
     bool areFramesPending() override;
 
+    bool prerender() override;
+
     void invalidateFrame() override;
 
     void flush() override;
 
 private:
-    struct FrameCache {
-        int x;
-        int y;
-        AVFrame* frame;
-        double lastUsed;
-    };
-
     void blendFrames(AVFrame* dstFrame, AVFrame* srcFrame, int srcX, int srcY);
-    int prepareSubFrame(AVSubtitleRect* rect, FrameCache& cache, int vWidth, int vHeight);
+    int getSubFrame(int64_t pts, AVSubtitleRect* rect, int vWidth, int vHeight,
+                    SubtitleBitmapCache::Entry** outEntry);
+    int prepareSubFrame(AVSubtitleRect* rect, int vWidth, int vHeight, int* outX, int* outY,
+                        AVFrame** outFrame);
 
     FrameQueue* mQueue;
-    std::vector<FrameCache> mFrameCache;
+    SubtitleBitmapCache mFrameCache;
     struct SwsContext* mSwsContext;
     int mCodecWidth;
     bool mInvalidate;
+
+    // Bounds of the last subtitle drawn, it is erased when the next one is drawn
+    SubtitleFrameQueue::Rect mDrawnBounds;
 };
 
 #endif //IMAGESUBHANDLER_H
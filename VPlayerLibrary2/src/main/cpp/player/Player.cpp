@@ -20,6 +20,12 @@ extern "C" {
 #define BEFORE_SEEK_SUBTITLES_TIME_MS 7000
 
 #define MAX_QUEUE_SIZE (15 * 1024 * 1024)
+
+// Range of playback speeds, audio is time stretched to keep its pitch
+#define MIN_PLAYBACK_SPEED 0.25
+#define MAX_PLAYBACK_SPEED 4.0
+
+#define DEFAULT_AUDIO_RESAMPLE_QUALITY 1
 #define sTag "NativePlayer"
 
 static int decode_interrupt_callback(void *player) {
@@ -43,18 +49,24 @@ static bool streamTypeExists(AVFormatContext *context, AVMediaType type) {
 }
 
 Player::Player() :
-        mCallback(NULL),
-        mReadThreadId(NULL),
+        mFilepath(NULL),
+        mDurationMs(0),
+        mLastSentPlaybackTimeSec(0),
         mVideoStream(NULL),
         mAudioStream(NULL),
         mSubtitleStream(NULL),
-        mVideoRenderer(NULL),
         mSubtitleFrameWidth(0),
         mSubtitleFrameHeight(0),
-        mFilepath(NULL),
-        mDurationMs(0),
-        mLastSentPlaybackTimeSec(0),
+        mSubtitleCacheBudget(0),
+        mPlaybackSpeed(1),
+        mAudioResampleQuality(DEFAULT_AUDIO_RESAMPLE_QUALITY),
+        mAudioPassthrough(false),
+        mAudioRendererPassthrough(false),
+        mVideoRenderer(NULL),
+        mCallback(NULL),
+        mReadThreadId(NULL),
         mShowVideo(true),
+        mBlendSubtitlesInYUV(false),
         mAbortRequested(false),
         mSeekRequested(false),
         mWaitingFrameAfterSeek(false),
@@ -135,7 +147,13 @@ void Player::togglePlayback() {
 }
 
 IAudioRenderer *Player::createAudioRenderer(AVCodecContext *context) {
-    return mCallback->createAudioRenderer(context);
+    IAudioRenderer* renderer = mCallback->createAudioRenderer(context, mAudioPassthrough);
+    const bool passthrough = renderer != NULL && renderer->isPassthrough();
+    if (passthrough != mAudioRendererPassthrough) {
+        mAudioRendererPassthrough = passthrough;
+        applyPlaybackSpeed();
+    }
+    return renderer;
 }
 
 double Player::getAudioLatency() {
@@ -263,6 +281,54 @@ void Player::setDefaultSubtitleFont(const char *fontPath, const char *fontFamily
     }
 }
 
+void Player::setBlendSubtitlesInYUV(bool flag) {
+    mBlendSubtitlesInYUV = flag;
+    if (mVideoStream) {
+        mVideoStream->setBlendSubtitlesInYUV(flag);
+    }
+}
+
+void Player::setSubtitleCacheBudget(int megabytes) {
+    mSubtitleCacheBudget = megabytes;
+    if (mSubtitleStream) {
+        mSubtitleStream->setCacheBudget(megabytes);
+    }
+}
+
+void Player::setPlaybackSpeed(double speed) {
+    mPlaybackSpeed = av_clipd(speed, MIN_PLAYBACK_SPEED, MAX_PLAYBACK_SPEED);
+    applyPlaybackSpeed();
+}
+
+void Player::setAudioResampleQuality(int quality) {
+    mAudioResampleQuality = quality;
+    if (mAudioStream) {
+        mAudioStream->setResampleQuality(quality);
+    }
+}
+
+void Player::setAudioPassthrough(bool flag) {
+    // Used when the audio renderer is created with the next stream
+    mAudioPassthrough = flag;
+}
+
+void Player::applyPlaybackSpeed() {
+    if (mInfiniteBuffer) {
+        // Realtime streams arrive at their own pace, the external clock follows the buffer instead
+        return;
+    }
+
+    // Compressed audio only plays at normal speed, video would drift away from it otherwise
+    const double speed = mAudioRendererPassthrough ? 1 : mPlaybackSpeed;
+    mExtClock.setSpeed(speed);
+    if (mVideoStream) {
+        mVideoStream->setPlaybackSpeed(speed);
+    }
+    if (mAudioStream) {
+        mAudioStream->setPlaybackSpeed(speed);
+    }
+}
+
 void Player::setCallback(IPlayerCallback *callback) {
     std::lock_guard<std::mutex> lk(mErrorMutex);
     mCallback = callback;
@@ -324,6 +390,7 @@ void Player::reset() {
         av_freep(&mFilepath);        // TODO check if this is needed
     }
     mAbortRequested = false;
+    mAudioRendererPassthrough = false;
     mDurationMs = 0;
 }
 
@@ -390,18 +457,21 @@ int Player::tOpenStreams(AVFormatContext *context) {
     if (streamTypeExists(context, AVMEDIA_TYPE_AUDIO)) {
         mAudioStream = new AudioStream(context, &mFlushPkt, this);
         mAudioStream->setCallback(mCallback);
+        mAudioStream->setResampleQuality(mAudioResampleQuality);
     }
 
     if (mShowVideo && streamTypeExists(context, AVMEDIA_TYPE_VIDEO)) {
         mVideoStream = new VideoStream(context, &mFlushPkt, this);
         mVideoStream->setCallback(mCallback);
         mVideoStream->setVideoStreamCallback(this);
+        mVideoStream->setBlendSubtitlesInYUV(mBlendSubtitlesInYUV);
         if (mVideoRenderer) {
             mVideoStream->setVideoRenderer(mVideoRenderer);
         }
         if (streamTypeExists(context, AVMEDIA_TYPE_SUBTITLE)) {
             mSubtitleStream = new SubtitleStream(context, &mFlushPkt, this);
             mSubtitleStream->setCallback(mCallback);
+            mSubtitleStream->setCacheBudget(mSubtitleCacheBudget);
             mVideoStream->setSubtitleComponent(mSubtitleStream);
         }
         mAttachmentsRequested = true;
@@ -411,6 +481,7 @@ int Player::tOpenStreams(AVFormatContext *context) {
         return error(AVERROR_STREAM_NOT_FOUND, "Failed to open file, stream invalid");
     }
     mInfiniteBuffer = mVideoStream ? mVideoStream->isRealTime() : mAudioStream->isRealTime();
+    applyPlaybackSpeed();
 
     if (mVideoStream) {
         mAVComponents.push_back((StreamComponent *) mVideoStream);
@@ -526,6 +597,9 @@ int Player::tReadLoop(AVFormatContext *context) {
                         return error(ret, "Seek failed because could not flush packets");
                     }
                 }
+                if (mSubtitleStream) {
+                    mSubtitleStream->flushBackgroundTracks();
+                }
                 if ((ret = readSubtitlesOnSeek(context, seekTarget, seekMin, seekMax)) < 0) {
                     return error(ret, "Unable to get subtitles around this seek time");
                 }
@@ -652,7 +726,8 @@ int Player::tReadLoop(AVFormatContext *context) {
                 if (c->canEnqueueStreamPacket(pkt)) {
 //                    _log("    Send packet to %ld | %ld | %d | %s", pkt.pts, pkt.duration, pkt.size,
 //                         c->typeName());
-                    // TODO check the pts and drop all frames if pts is behind main clock, test by removing neon
+                    // Late packets are dropped by the stream before decoding since the clock
+                    // has moved on by the time packets read ahead here are dequeued
                     if ((ret = c->getPacketQueue()->enqueue(&pkt)) < 0) {
                         return error(ret, "Cannot enqueue packet to stream component");
                     }
@@ -662,7 +737,10 @@ int Player::tReadLoop(AVFormatContext *context) {
             }
         }
         if (!handled) {
-            if (context->streams[pkt.stream_index]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO) {
+            // Text subtitle streams that are not picked are parsed in the background
+            if ((!mSubtitleStream || !mSubtitleStream->feedBackgroundPacket(&pkt))
+                    && context->streams[pkt.stream_index]->codecpar->codec_type
+                       != AVMEDIA_TYPE_AUDIO) {
                 __android_log_print(ANDROID_LOG_VERBOSE, sTag, "This packet is not handled %i %ld",
                                     pkt.stream_index, pkt.pts);
             }
@@ -769,6 +847,11 @@ int Player::readSubtitlesOnSeek(AVFormatContext* ctx, int64_t target, int64_t mi
                 if ((ret = mSubtitleStream->getPacketQueue()->enqueue(&pkt)) < 0) {
                     return ret;
                 }
+            } else {
+                if (pkt.pts >= 0) {
+                    mSubtitleStream->feedBackgroundPacket(&pkt);
+                }
+                av_packet_unref(&pkt);
             }
         }
         while(pkt.pts < endTime && target == mSeekPos);
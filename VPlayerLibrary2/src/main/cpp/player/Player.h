@@ -9,6 +9,7 @@ extern "C" {
 #include <libavutil/time.h>
 }
 #include <android/log.h>
+#include <atomic>
 #include <condition_variable>
 #include <thread>
 #include <vector>
@@ -66,6 +67,11 @@ public:
 
     void setSubtitleFrameSize(int width, int height);
     void setDefaultSubtitleFont(const char* fontPath, const char* fontFamily);
+    void setBlendSubtitlesInYUV(bool flag);
+    void setSubtitleCacheBudget(int megabytes);
+    void setPlaybackSpeed(double speed);
+    void setAudioResampleQuality(int quality);
+    void setAudioPassthrough(bool flag);
 
     void setCallback(IPlayerCallback *callback);
 
@@ -74,6 +80,7 @@ public:
     void invalidateVideoFrame();
 private:
     void resizeSubtitleFrameWithAspectRatio(int width, int height);
+    void applyPlaybackSpeed();
     void reset();
     void sleepMs(long ms);
     int sendMetadataReady(AVFormatContext *context);
@@ -102,12 +109,20 @@ private:
     int mSubtitleFrameHeight;
     char mSubtitleFontPath[MAX_STRING_LENGTH];
     char mSubtitleFontFamily[MAX_STRING_LENGTH];
+    int mSubtitleCacheBudget;
+
+    double mPlaybackSpeed;
+    int mAudioResampleQuality;
+    bool mAudioPassthrough;
+    // Whether the current audio renderer took the compressed stream, playback stays at 1x then
+    std::atomic<bool> mAudioRendererPassthrough;
 
     IVideoRenderer* mVideoRenderer;
     IPlayerCallback* mCallback;
     std::condition_variable mReadThreadCondition;
     std::thread* mReadThreadId;
     bool mShowVideo;
+    std::atomic<bool> mBlendSubtitlesInYUV;
 
     bool mAbortRequested;
     bool mSeekRequested;
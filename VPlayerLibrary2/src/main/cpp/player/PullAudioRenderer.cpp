@@ -0,0 +1,108 @@
+#include "PullAudioRenderer.h"
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+extern "C" {
+#include <libavutil/common.h>
+}
+
+// Waiting for room in the queue checks this many times per queue length
+#define WRITE_POLLS_PER_QUEUE 4
+#define MAX_WRITE_POLL_MS 10
+
+static const char* sTag = "PullAudioRenderer";
+
+static size_t queueBytes(int numChannels, int sampleRate, int queueMs) {
+    const size_t frameBytes = (size_t) numChannels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+    return FFMAX((size_t) sampleRate * queueMs / 1000, (size_t) 1) * frameBytes;
+}
+
+PullAudioRenderer::PullAudioRenderer(int numChannels, int sampleRate, int queueMs) :
+        mChannels(numChannels),
+        mSampleRate(sampleRate),
+        mLayout(av_get_default_channel_layout(numChannels)),
+        mPollMs(av_clip(queueMs / WRITE_POLLS_PER_QUEUE, 1, MAX_WRITE_POLL_MS)),
+        mRing(queueBytes(numChannels, sampleRate, queueMs)),
+        mPaused(false),
+        mGain(1),
+        mFlushCount(0) {
+    __android_log_print(ANDROID_LOG_VERBOSE, sTag, "Queue of %d ms (%zu bytes) for %d channels",
+                        queueMs, mRing.capacity(), numChannels);
+}
+
+PullAudioRenderer::~PullAudioRenderer() {
+}
+
+uint8_t *PullAudioRenderer::getBuffer(int /* size */) {
+    // Audio is copied into the ring
+    return NULL;
+}
+
+int PullAudioRenderer::write(uint8_t *data, int len, int /* numSamples */) {
+    const int flushCount = mFlushCount;
+    size_t written = 0;
+    while (written < (size_t) len) {
+        const size_t ret = mRing.write(data + written, (size_t) len - written);
+        written += ret;
+        if (written < (size_t) len && ret == 0) {
+            if (flushCount != mFlushCount) {
+                // Flushed while waiting for room, the rest would be dropped anyway
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(mPollMs));
+        }
+    }
+    return len;
+}
+
+int PullAudioRenderer::pause() {
+    mPaused = true;
+    return 0;
+}
+
+int PullAudioRenderer::play() {
+    mPaused = false;
+    return 0;
+}
+
+int PullAudioRenderer::flush() {
+    mRing.discard();
+    mFlushCount++;
+    return 0;
+}
+
+int PullAudioRenderer::stop() {
+    mPaused = true;
+    return flush();
+}
+
+int PullAudioRenderer::setVolume(float gain) {
+    mGain = gain;
+    return 0;
+}
+
+double PullAudioRenderer::getLatency() {
+    return (double) mRing.available() / bytesPerFrame() / mSampleRate + getSinkDelay();
+}
+
+double PullAudioRenderer::updateLatency(bool /* force */) {
+    // Always exact, nothing to measure
+    return getLatency();
+}
+
+int PullAudioRenderer::pull(uint8_t *out, int len) {
+    const size_t read = mPaused ? 0 : mRing.read(out, (size_t) len);
+    memset(out + read, 0, len - read);
+
+    const float gain = mGain;
+    if (gain == 0) {
+        memset(out, 0, read);
+    } else if (gain != 1) {
+        int16_t* samples = (int16_t*) out;
+        for (size_t i = 0; i < read / sizeof(int16_t); i++) {
+            samples[i] = (int16_t) av_clip_int16((int) (samples[i] * gain));
+        }
+    }
+    return (int) read;
+}
@@ -0,0 +1,90 @@
+#ifndef PULLAUDIORENDERER_H
+#define PULLAUDIORENDERER_H
+
+#include <android/log.h>
+#include <atomic>
+#include "IAudioRenderer.h"
+#include "AudioRingBuffer.h"
+
+// Audio queued for the sink when the renderer does not pick its own depth
+#define DEFAULT_AUDIO_QUEUE_MS 100
+
+/**
+ * Renderer for sinks that ask for audio when they need it, such as audio callback APIs. The audio
+ * thread writes into a ring buffer, blocking until all of it is queued or flushed, and the sink
+ * takes from it with pull() on its own thread. Latency is what is queued in the ring plus the delay
+ * the sink reports.
+ */
+class PullAudioRenderer : public IAudioRenderer {
+public:
+    /**
+     * @param queueMs audio kept queued for the sink, more survives longer stalls of the audio
+     *                thread but delays pausing, seeking and volume changes as much
+     */
+    PullAudioRenderer(int numChannels, int sampleRate, int queueMs = DEFAULT_AUDIO_QUEUE_MS);
+    virtual ~PullAudioRenderer();
+
+    uint8_t* getBuffer(int size) override;
+    int write(uint8_t *data, int len, int numSamples) override;
+    int pause() override;
+    int play() override;
+    int flush() override;
+    int stop() override;
+    int setVolume(float gain) override;
+
+    int numChannels() override {
+        return mChannels;
+    }
+
+    int sampleRate() override {
+        return mSampleRate;
+    }
+
+    int64_t layout() override {
+        return mLayout;
+    }
+
+    enum AVSampleFormat format() override {
+        return AV_SAMPLE_FMT_S16;
+    }
+
+    bool isPassthrough() override {
+        return false;
+    }
+
+    double getLatency() override;
+    double updateLatency(bool force = false) override;
+
+    /**
+     * Take the next audio for the sink, called from the sink's thread. Silence fills whatever is
+     * not queued yet and everything while paused.
+     * @return number of bytes of queued audio, the rest of len is silence
+     */
+    int pull(uint8_t* out, int len);
+
+protected:
+    /**
+     * Time from audio being pulled until it is heard
+     * @return delay in seconds
+     */
+    virtual double getSinkDelay() = 0;
+
+    int bytesPerFrame() {
+        return mChannels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+    }
+
+private:
+    const int mChannels;
+    const int mSampleRate;
+    const int64_t mLayout;
+    const int mPollMs;
+    AudioRingBuffer mRing;
+
+    std::atomic<bool> mPaused;
+    std::atomic<float> mGain;
+
+    // Incremented by flush and stop to release a write waiting for room
+    std::atomic<int> mFlushCount;
+};
+
+#endif //PULLAUDIORENDERER_H
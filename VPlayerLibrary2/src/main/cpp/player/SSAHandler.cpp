@@ -1,5 +1,9 @@
 #include "SSAHandler.h"
 #include "ASSBitmap.h"
+#include <algorithm>
+
+// Events starting this far ahead of the last frame are rendered early when the render thread idles
+#define PRERENDER_LOOKAHEAD_MS 2000
 
 static const char* sTag = "SSAHandler";
 static const char *sFontMimeTypes[] = {
@@ -21,19 +25,24 @@ static int isFontAttachment(const AVStream * st) {
     return 0;
 }
 
-SSAHandler::SSAHandler(AVCodecID codecID) :
+SSAHandler::SSAHandler(AVCodecID codecID, SubtitleTrackCache* trackCache) :
         SubtitleHandlerBase(codecID),
         mRenderer(NULL),
+        mTrackCache(trackCache),
         mAssTrack(NULL),
+        mSkipNextFlush(false),
         mTmpSubtitle({0}),
-        mLastPts(0) {
+        mLastPts(0),
+        mPrerenderedPts(0),
+        mPrerendered(false),
+        mPrerenderCursor(0),
+        mDrawnWidth(0),
+        mDrawnHeight(0),
+        mDrawnInvalidated(true) {
 }
 
 SSAHandler::~SSAHandler() {
-    if (mAssTrack) {
-        ass_free_track(mAssTrack);
-        mAssTrack = NULL;
-    }
+    mAssTrack = NULL;
     if (mRenderer) {
         delete mRenderer;
         mRenderer = NULL;
@@ -41,7 +50,7 @@ SSAHandler::~SSAHandler() {
     avsubtitle_free(&mTmpSubtitle);
 }
 
-int SSAHandler::open(AVCodecContext *cContext, AVFormatContext *fContext) {
+int SSAHandler::open(AVCodecContext *cContext, AVFormatContext *fContext, int streamIndex) {
     if (mRenderer) {
         delete mRenderer;
     }
@@ -51,15 +60,23 @@ int SSAHandler::open(AVCodecContext *cContext, AVFormatContext *fContext) {
         return mRenderer->getError();
     }
 
-    // Create the track
-    const char* header = cContext->subtitle_header ? (char*) cContext->subtitle_header : NULL;
-    const int headerSize = cContext->subtitle_header ? cContext->subtitle_header_size : 0;
-    mAssTrack = mRenderer->createTrack(header, headerSize);
+    // Use the track of this stream, it may already be parsed in the background
+    bool hasEvents = false;
+    mAssTrack = mTrackCache->attach(streamIndex, cContext, &hasEvents);
     if (!mAssTrack) {
         __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot allocate ass track");
         return AVERROR(ENOMEM);
     }
 
+    // Opening the stream queues a flush packet that would erase the parsed subtitles
+    mSkipNextFlush = hasEvents;
+    {
+        std::lock_guard<std::mutex> lk(mAssMutex);
+        mEventStarts.clear();
+        mPrerenderCursor = 0;
+    }
+    mDrawnInvalidated = true;
+
     // Load font attachments from video into the engine
     for (int i = 0; i < fContext->nb_streams; i++) {
         const AVStream *st = fContext->streams[i];
@@ -69,13 +86,14 @@ int SSAHandler::open(AVCodecContext *cContext, AVFormatContext *fContext) {
             if (tag) {
                 __android_log_print(ANDROID_LOG_VERBOSE, sTag, "Loading font: %s", tag->value);
                 mRenderer->addFont(tag->value, (char*) st->codecpar->extradata,
-                                   st->codecpar->extradata_size);
+                                   st->codecpar->extradata_size, false);
             } else {
                 __android_log_print(ANDROID_LOG_WARN, sTag,
                                     "Ignoring font attachment, no filename.");
             }
         }
     }
+    mRenderer->updateFonts();
     return 0;
 }
 
@@ -83,25 +101,89 @@ void SSAHandler::abort() {
     // Is not needed
 }
 
-int SSAHandler::blendToFrame(double pts, AVFrame *vFrame, intptr_t pktSerial, bool force) {
-    ASS_Image* image;
+int SSAHandler::blendToFrame(double pts, AVFrame *vFrame, intptr_t pktSerial, bool force,
+                             std::vector<SubtitleFrameQueue::Rect>* outDirtyRects,
+                             SubtitleFrameQueue::Rect* outDamage) {
+    // Burned in subs are blended on the video thread while the render thread keeps rendering
+    // ahead, which frees the images of this frame. Hold the lock until they are drawn
+    std::lock_guard<std::mutex> lk(mAssMutex);
     int changed = 0;
     mRenderer->setSize(vFrame->width, vFrame->height);
-    {
-        std::lock_guard<std::mutex> lk(mAssMutex);
-        image = mRenderer->renderFrame(mAssTrack, (int64_t) vFrame->pts, &changed);
-        if (force) {
-            changed = 2;
-        }
+    ASS_Image* image = mRenderer->renderFrame(mAssTrack, (int64_t) vFrame->pts, &changed);
+    mLastPts = vFrame->pts;
+
+    // libass compared against the frame rendered ahead, not against the frame drawn last
+    force |= mPrerendered;
+    mPrerendered = false;
+    if (force) {
+        changed = 2;
     }
-    if (changed == 2) {
+
+    // Images that only moved (1) are drawn again at their new place
+    if (changed > 0) {
+        if (outDamage) {
+            computeDamage(image, vFrame->width, vFrame->height, force, outDamage);
+        } else {
+            // Bitmaps of the images kept are released after this frame, cannot compare with them
+            mDrawnInvalidated = true;
+        }
+        alphablend::YUVPlanes planes;
+        const bool isYUV = SubtitleStream::getYUVPlanes(vFrame, &planes);
         for (; image != NULL; image = image->next) {
-            uint8_t* dst = vFrame->data[0] + vFrame->linesize[0] * image->dst_y + image->dst_x * 4;
-            ASSBitmap::blendSubtitle(dst, (size_t) vFrame->linesize[0], image);
+            if (isYUV) {
+                alphablend::blendMaskToYUV(planes, image->dst_x, image->dst_y, image->bitmap,
+                                           (size_t) image->stride, image->w, image->h,
+                                           image->color);
+            } else {
+                uint8_t* dst = vFrame->data[0] + vFrame->linesize[0] * image->dst_y
+                               + image->dst_x * 4;
+                ASSBitmap::blendSubtitle(dst, (size_t) vFrame->linesize[0], image);
+            }
+            if (outDirtyRects) {
+                outDirtyRects->push_back({image->dst_x, image->dst_y, image->w, image->h});
+            }
+        }
+    }
+    return changed > 0 ? 2 : 0;
+}
+
+void SSAHandler::computeDamage(ASS_Image *images, int width, int height, bool redrawAll,
+                               SubtitleFrameQueue::Rect *outDamage) {
+    if (mDrawnInvalidated.exchange(false) || redrawAll || width != mDrawnWidth
+            || height != mDrawnHeight) {
+        *outDamage = {0, 0, width, height};
+    } else {
+        // Walk both lists in order like libass does, only images that differ are redrawn. libass
+        // releases the last images after rendering the new ones, so same address is same bitmap
+        *outDamage = {0, 0, 0, 0};
+        size_t i = 0;
+        for (ASS_Image* image = images; image != NULL; image = image->next, i++) {
+            const DrawnImage drawn = {image->dst_x, image->dst_y, image->w, image->h,
+                                      image->stride, image->color, image->bitmap};
+            if (i < mDrawnImages.size() && mDrawnImages[i] == drawn) {
+                continue;
+            }
+            outDamage->unite({drawn.x, drawn.y, drawn.width, drawn.height});
+            if (i < mDrawnImages.size()) {
+                const DrawnImage& last = mDrawnImages[i];
+                outDamage->unite({last.x, last.y, last.width, last.height});
+            }
+        }
+
+        // Images that are gone are erased
+        for (; i < mDrawnImages.size(); i++) {
+            const DrawnImage& last = mDrawnImages[i];
+            outDamage->unite({last.x, last.y, last.width, last.height});
         }
-        mLastPts = vFrame->pts;
     }
-    return changed == 2 ? 2 : 0;
+
+    mDrawnImages.clear();
+    for (ASS_Image* image = images; image != NULL; image = image->next) {
+        mDrawnImages.push_back({image->dst_x, image->dst_y, image->w, image->h, image->stride,
+                                image->color, image->bitmap});
+    }
+    mDrawnWidth = width;
+    mDrawnHeight = height;
 }
 
 void SSAHandler::setDefaultFont(const char *fontPath, const char *fontFamily) {
@@ -110,6 +192,17 @@ void SSAHandler::setDefaultFont(const char *fontPath, const char *fontFamily) {
     }
 }
 
+void SSAHandler::setCacheBudget(int megabytes) {
+    std::lock_guard<std::mutex> lk(mAssMutex);
+    if (mRenderer) {
+        mRenderer->setCacheBudget(megabytes);
+    }
+}
+
+ASSRenderer::Stats SSAHandler::getRendererStats() {
+    return mRenderer ? mRenderer->getStats() : ASSRenderer::Stats();
+}
+
 AVSubtitle *SSAHandler::getSubtitle() {
     return &mTmpSubtitle;
 }
@@ -119,12 +212,71 @@ bool SSAHandler::areFramesPending() {
     return false;
 }
 
+bool SSAHandler::prerender() {
+    std::lock_guard<std::mutex> lk(mAssMutex);
+    if (!mRenderer || !mAssTrack) {
+        return false;
+    }
+
+    // Events are stored in the order they were read, not by time, keep their starts sorted
+    updateEventStarts();
+
+    // Find the next start after the ones already rendered, searching again only after seeking back
+    const int64_t from = std::max(mLastPts, mPrerenderedPts);
+    if (mPrerenderCursor > mEventStarts.size()
+            || (mPrerenderCursor > 0 && mEventStarts[mPrerenderCursor - 1] > from)) {
+        mPrerenderCursor = (size_t) (std::upper_bound(mEventStarts.begin(), mEventStarts.end(),
+                                                      from) - mEventStarts.begin());
+    }
+    while (mPrerenderCursor < mEventStarts.size() && mEventStarts[mPrerenderCursor] <= from) {
+        mPrerenderCursor++;
+    }
+    if (mPrerenderCursor >= mEventStarts.size()
+            || mEventStarts[mPrerenderCursor] - mLastPts > PRERENDER_LOOKAHEAD_MS) {
+        return false;
+    }
+    const int64_t next = mEventStarts[mPrerenderCursor];
+    mRenderer->prerenderFrame(mAssTrack, next);
+    mPrerenderedPts = next;
+    mPrerendered = true;
+    return true;
+}
+
+void SSAHandler::updateEventStarts() {
+    const size_t numEvents = (size_t) mAssTrack->n_events;
+    if (numEvents < mEventStarts.size()) {
+        // Events were removed, start over
+        mEventStarts.clear();
+        mPrerenderCursor = 0;
+    }
+
+    // New events are appended to the track, insert only those
+    for (size_t i = mEventStarts.size(); i < numEvents; i++) {
+        const int64_t start = mAssTrack->events[i].Start;
+        auto it = std::upper_bound(mEventStarts.begin(), mEventStarts.end(), start);
+        if (it - mEventStarts.begin() < (ptrdiff_t) mPrerenderCursor) {
+            mPrerenderCursor++;
+        }
+        mEventStarts.insert(it, start);
+    }
+}
+
 void SSAHandler::invalidateFrame() {
     // Is not used
 }
 
 void SSAHandler::flush() {
+    // The subtitle frames were erased, everything shown next is new
+    mDrawnInvalidated = true;
+    std::lock_guard<std::mutex> lk(mAssMutex);
+    mPrerenderedPts = 0;
+    if (mSkipNextFlush) {
+        mSkipNextFlush = false;
+        return;
+    }
     ass_flush_events(mAssTrack);
+    mEventStarts.clear();
+    mPrerenderCursor = 0;
 }
 
 bool SSAHandler::handleDecodedSubtitle(AVSubtitle* subtitle, intptr_t pktSerial) {
@@ -6,10 +6,10 @@
 
 class SSAHandler : public SubtitleStream::SubtitleHandlerBase {
 public:
-    SSAHandler(AVCodecID codecID);
+    SSAHandler(AVCodecID codecID, SubtitleTrackCache* trackCache);
     ~SSAHandler();
 
-    int open(AVCodecContext *cContext, AVFormatContext *fContext) override;
+    int open(AVCodecContext *cContext, AVFormatContext *fContext, int streamIndex) override;
 
     void abort() override;
 
@@ -17,22 +17,70 @@ public:
 
     AVSubtitle *getSubtitle() override;
 
-    int blendToFrame(double pts, AVFrame *frame, intptr_t pktSerial, bool force = false) override;
+    int blendToFrame(double pts, AVFrame *frame, intptr_t pktSerial, bool force,
+                     std::vector<SubtitleFrameQueue::Rect>* outDirtyRects,
+                     SubtitleFrameQueue::Rect* outDamage) override;
 
     void setDefaultFont(const char *fontPath, const char *fontFamily) override;
 
+    void setCacheBudget(int megabytes) override;
+
     bool areFramesPending() override;
 
+    bool prerender() override;
+
     void invalidateFrame() override;
 
     void flush() override;
 
+    // Render times of the handler's own renderer, blendToFrame renders before it blends
+    ASSRenderer::Stats getRendererStats();
+
 private:
+    // What was drawn of an image, enough to tell if the next frame draws the same
+    struct DrawnImage {
+        int x;
+        int y;
+        int width;
+        int height;
+        int stride;
+        uint32_t color;
+        const unsigned char* bitmap;
+
+        bool operator==(const DrawnImage& other) const {
+            return bitmap == other.bitmap && x == other.x && y == other.y
+                   && width == other.width && height == other.height
+                   && stride == other.stride && color == other.color;
+        }
+    };
+
+    void updateEventStarts();
+    void computeDamage(ASS_Image* images, int width, int height, bool redrawAll,
+                       SubtitleFrameQueue::Rect* outDamage);
+
     std::mutex mAssMutex;
     ASSRenderer* mRenderer;
+    SubtitleTrackCache* mTrackCache;
+
+    // Owned by the track cache
     ASS_Track* mAssTrack;
+    bool mSkipNextFlush;
     AVSubtitle mTmpSubtitle;
     int64_t mLastPts;
+
+    // Start of the latest event rendered ahead, the next frame is redrawn fully after it
+    int64_t mPrerenderedPts;
+    bool mPrerendered;
+
+    // Start times of the track's events sorted, the cursor is at the first one not rendered ahead
+    std::vector<int64_t> mEventStarts;
+    size_t mPrerenderCursor;
+
+    // Images of the last frame drawn, compared against the next to find the changed areas
+    std::vector<DrawnImage> mDrawnImages;
+    int mDrawnWidth;
+    int mDrawnHeight;
+    std::atomic<bool> mDrawnInvalidated;
 };
 
 #endif //SSAHANDLER_H
@@ -1,7 +1,6 @@
 #include "StreamComponent.h"
 
 #define MIN_FRAMES 25
-#define MIN_CPU_COUNT 2
 
 const char *sTag = "StreamComponent";
 
@@ -166,7 +165,10 @@ int StreamComponent::open() {
         return ret;
     }
     mCContext->pkt_timebase = mFContext->streams[mStreamIndex]->time_base;
-    mCContext->thread_count = std::max((int) std::thread::hardware_concurrency(), MIN_CPU_COUNT);
+    mIsRealTime = !strcmp(mFContext->iformat->name, "rtp")
+           || !strcmp(mFContext->iformat->name, "rtsp")
+           || !strcmp(mFContext->iformat->name, "sdp");
+    DecoderThreadBudget::configure(mCContext, mType, mIsRealTime);
 
     // TODO Enable to see if this helps anything for speedup, non complient as a setting
     // TODO see if we want to use avcodec_open2 options => threads(auto), refcounted_frames(1)
@@ -175,9 +177,6 @@ int StreamComponent::open() {
         return ret;
     }
     mFContext->streams[mStreamIndex]->discard = AVDISCARD_DEFAULT;
-    mIsRealTime = !strcmp(mFContext->iformat->name, "rtp")
-           || !strcmp(mFContext->iformat->name, "rtsp")
-           || !strcmp(mFContext->iformat->name, "sdp");
 
     __android_log_print(ANDROID_LOG_VERBOSE, sTag, "%s stream has opened", typeName());
 
@@ -12,6 +12,7 @@ extern "C" {
 #include "IPlayerCallback.h"
 #include "IAudioRenderer.h"
 #include "Clock.h"
+#include "DecoderThreadBudget.h"
 
 class StreamComponent {
 public:
@@ -0,0 +1,84 @@
+#include "SubtitleBitmapCache.h"
+
+static inline size_t hashCombine(size_t hash, size_t value) {
+    return hash ^ (value + 0x9e3779b9 + (hash << 6) + (hash >> 2));
+}
+
+size_t SubtitleBitmapCache::KeyHash::operator()(const Key &key) const {
+    size_t hash = std::hash<int64_t>()(key.pts);
+    hash = hashCombine(hash, std::hash<uint64_t>()(key.contentHash));
+    hash = hashCombine(hash, (size_t) key.x);
+    hash = hashCombine(hash, (size_t) key.y);
+    hash = hashCombine(hash, (size_t) key.width);
+    hash = hashCombine(hash, (size_t) key.height);
+    hash = hashCombine(hash, (size_t) key.targetWidth);
+    return hashCombine(hash, (size_t) key.targetHeight);
+}
+
+SubtitleBitmapCache::SubtitleBitmapCache(size_t maxBytes) :
+        mBytes(0),
+        mMaxBytes(maxBytes) {
+}
+
+SubtitleBitmapCache::~SubtitleBitmapCache() {
+    clear();
+}
+
+SubtitleBitmapCache::Entry *SubtitleBitmapCache::get(const Key &key) {
+    auto it = mIndex.find(key);
+    if (it == mIndex.end()) {
+        return NULL;
+    }
+    mNodes.splice(mNodes.begin(), mNodes, it->second);
+    return &it->second->entry;
+}
+
+SubtitleBitmapCache::Entry *SubtitleBitmapCache::put(const Key &key, int x, int y,
+                                                     AVFrame *frame) {
+    auto it = mIndex.find(key);
+    if (it != mIndex.end()) {
+        mBytes -= it->second->bytes;
+        freeNode(*it->second);
+        mNodes.erase(it->second);
+        mIndex.erase(it);
+    }
+
+    // Always keep the newest image even if it alone is over the limit
+    const size_t bytes = (size_t) frame->linesize[0] * frame->height;
+    trim(bytes < mMaxBytes ? mMaxBytes - bytes : 0);
+
+    mNodes.push_front({key, {x, y, frame}, bytes});
+    mIndex[key] = mNodes.begin();
+    mBytes += bytes;
+    return &mNodes.front().entry;
+}
+
+void SubtitleBitmapCache::setMaxBytes(size_t maxBytes) {
+    mMaxBytes = maxBytes;
+    trim(maxBytes);
+}
+
+void SubtitleBitmapCache::clear() {
+    for (Node& node : mNodes) {
+        freeNode(node);
+    }
+    mNodes.clear();
+    mIndex.clear();
+    mBytes = 0;
+}
+
+void SubtitleBitmapCache::trim(size_t maxBytes) {
+    while (!mNodes.empty() && mBytes > maxBytes) {
+        Node& last = mNodes.back();
+        mBytes -= last.bytes;
+        mIndex.erase(last.key);
+        freeNode(last);
+        mNodes.pop_back();
+    }
+}
+
+void SubtitleBitmapCache::freeNode(Node &node) {
+    // Buffers are not reference counted, free the image data before the frame itself
+    av_freep(&node.entry.frame->data[0]);
+    av_frame_free(&node.entry.frame);
+}
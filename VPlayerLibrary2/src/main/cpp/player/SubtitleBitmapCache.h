@@ -0,0 +1,79 @@
+#ifndef SUBTITLEBITMAPCACHE_H
+#define SUBTITLEBITMAPCACHE_H
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+#include <list>
+#include <unordered_map>
+
+/**
+ * Least recently used cache of bitmap subtitles already converted and scaled to a frame size,
+ * bounded by the bytes of the images it holds. Seeking back or going back to a previous frame
+ * size reuses the conversions instead of scaling the subtitle again.
+ */
+class SubtitleBitmapCache {
+public:
+    struct Key {
+        int64_t pts;
+        // Hash of the subtitle's pixels and palette when it has no pts, 0 otherwise
+        uint64_t contentHash;
+        int x;
+        int y;
+        int width;
+        int height;
+        int targetWidth;
+        int targetHeight;
+
+        bool operator==(const Key& other) const {
+            return pts == other.pts && contentHash == other.contentHash && x == other.x
+                   && y == other.y && width == other.width && height == other.height
+                   && targetWidth == other.targetWidth && targetHeight == other.targetHeight;
+        }
+    };
+
+    struct Entry {
+        // Position of the scaled image in the target frame
+        int x;
+        int y;
+        AVFrame* frame;
+    };
+
+    SubtitleBitmapCache(size_t maxBytes);
+    ~SubtitleBitmapCache();
+
+    // Returns the entry and marks it as most recently used, NULL if not cached
+    Entry* get(const Key& key);
+
+    /**
+     * Add the image to the cache, evicts the least recently used images to fit it
+     * @param frame image with its own buffer, the cache frees it when evicted
+     */
+    Entry* put(const Key& key, int x, int y, AVFrame* frame);
+
+    // Evicts the least recently used images if they no longer fit
+    void setMaxBytes(size_t maxBytes);
+
+    void clear();
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Node {
+        Key key;
+        Entry entry;
+        size_t bytes;
+    };
+
+    void freeNode(Node& node);
+    void trim(size_t maxBytes);
+
+    std::list<Node> mNodes;
+    std::unordered_map<Key, std::list<Node>::iterator, KeyHash> mIndex;
+    size_t mBytes;
+    size_t mMaxBytes;
+};
+
+#endif //SUBTITLEBITMAPCACHE_H
@@ -1,7 +1,31 @@
 #include "SubtitleFrameQueue.h"
 
+// Merging more rects than this is not worth it, clear the whole frame instead
+#define MAX_DIRTY_RECTS 16
+
 static const char* sTag = "SubtitleFrameQueue";
 
+static bool rectsIntersect(const SubtitleFrameQueue::Rect& a, const SubtitleFrameQueue::Rect& b) {
+    return a.x <= b.x + b.width && b.x <= a.x + a.width
+           && a.y <= b.y + b.height && b.y <= a.y + a.height;
+}
+
+void SubtitleFrameQueue::Rect::unite(const Rect &other) {
+    if (other.isEmpty()) {
+        return;
+    }
+    if (isEmpty()) {
+        *this = other;
+        return;
+    }
+    const int right = std::max(x + width, other.x + other.width);
+    const int bottom = std::max(y + height, other.y + other.height);
+    x = std::min(x, other.x);
+    y = std::min(y, other.y);
+    width = right - x;
+    height = bottom - y;
+}
+
 SubtitleFrameQueue::SubtitleFrameQueue() :
         mFrames(NULL),
         mFrameInvalidated(NULL),
@@ -21,6 +45,8 @@ int SubtitleFrameQueue::resize(size_t size, int width, int height, AVPixelFormat
     mFormat = format;
     mFrames = new AVFrame*[size];
     mFrameInvalidated = new bool[size];
+    mDirtyRects.resize(size);
+    mDamage.assign(size, {0, 0, width, height});
 
     int ret;
     if (size > 0) {
@@ -38,6 +64,8 @@ int SubtitleFrameQueue::resize(size_t size, int width, int height, AVPixelFormat
                 av_frame_free(&frame);
                 return ret;
             }
+            // Frames are only cleared where subtitles were drawn after this, start transparent
+            memset(frame->data[0], 0, static_cast<size_t>(height * frame->linesize[0]));
             mFrames[i] = frame;
             mFrameInvalidated[i] = false;
         }
@@ -51,16 +79,83 @@ AVFrame *SubtitleFrameQueue::getNextFrame(int64_t pts) {
         return NULL;
     }
 
-    // If the next frame is invalidated, then clear its data to be returned
+    // If the next frame is invalidated, then clear the areas drawn to before it is returned
     AVFrame* frame = mFrames[mFrameNextIndex];
     if (mFrameInvalidated[mFrameNextIndex]) {
         mFrameInvalidated[mFrameNextIndex] = false;
-        memset(frame->data[0], 0, static_cast<size_t>(frame->height * frame->linesize[0]));
+        clearDirtyRects(mFrameNextIndex);
     }
     frame->pts = pts;
     return frame;
 }
 
+void SubtitleFrameQueue::addDirtyRects(const std::vector<Rect>& rects) {
+    if (mFrames == NULL) {
+        return;
+    }
+    std::vector<Rect>& dirtyRects = mDirtyRects[mFrameNextIndex];
+    for (Rect rect : rects) {
+        // Clip to the frame
+        const int right = std::min(rect.x + rect.width, mWidth);
+        const int bottom = std::min(rect.y + rect.height, mHeight);
+        rect.x = std::max(rect.x, 0);
+        rect.y = std::max(rect.y, 0);
+        rect.width = right - rect.x;
+        rect.height = bottom - rect.y;
+        if (rect.width <= 0 || rect.height <= 0) {
+            continue;
+        }
+
+        // Grow any rect this touches, glyphs of a line and their outlines usually overlap
+        bool merged = true;
+        while (merged) {
+            merged = false;
+            for (size_t i = 0; i < dirtyRects.size(); i++) {
+                if (rectsIntersect(dirtyRects[i], rect)) {
+                    rect.unite(dirtyRects[i]);
+                    dirtyRects.erase(dirtyRects.begin() + i);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+        dirtyRects.push_back(rect);
+    }
+    if (dirtyRects.size() > MAX_DIRTY_RECTS) {
+        dirtyRects.clear();
+        dirtyRects.push_back({0, 0, mWidth, mHeight});
+    }
+}
+
+void SubtitleFrameQueue::setNextFrameDamage(const Rect &damage) {
+    if (mFrames == NULL) {
+        return;
+    }
+    const int right = std::min(damage.x + damage.width, mWidth);
+    const int bottom = std::min(damage.y + damage.height, mHeight);
+    Rect& rect = mDamage[mFrameNextIndex];
+    rect.x = std::max(damage.x, 0);
+    rect.y = std::max(damage.y, 0);
+    rect.width = std::max(right - rect.x, 0);
+    rect.height = std::max(bottom - rect.y, 0);
+}
+
+void SubtitleFrameQueue::clearDirtyRects(int index) {
+    AVFrame* frame = mFrames[index];
+    for (const Rect& rect : mDirtyRects[index]) {
+        uint8_t* dst = frame->data[0] + rect.y * frame->linesize[0] + rect.x * 4;
+        const size_t length = static_cast<size_t>(rect.width * 4);
+        if (rect.width == mWidth) {
+            memset(dst, 0, static_cast<size_t>(rect.height * frame->linesize[0]));
+        } else {
+            for (int y = 0; y < rect.height; y++, dst += frame->linesize[0]) {
+                memset(dst, 0, length);
+            }
+        }
+    }
+    mDirtyRects[index].clear();
+}
+
 AVFrame* SubtitleFrameQueue::getFirstFrame() {
     return isEmpty() ? NULL : mFrames[mFrameHeadIndex];
 }
@@ -74,7 +169,7 @@ int SubtitleFrameQueue::pushNextFrame() {
     return 0;
 }
 
-AVFrame* SubtitleFrameQueue::dequeue() {
+AVFrame* SubtitleFrameQueue::dequeue(Rect* outDamage) {
     if (isEmpty()) {
         __android_log_print(ANDROID_LOG_WARN, sTag, "Cannot dequeue when no data in queue!");
         return NULL;
@@ -82,6 +177,9 @@ AVFrame* SubtitleFrameQueue::dequeue() {
 
     // Return the removed frame and invalidate its slot, it will be emptied later
     AVFrame* frame = mFrames[mFrameHeadIndex];
+    if (outDamage) {
+        *outDamage = mDamage[mFrameHeadIndex];
+    }
     mFrameInvalidated[mFrameHeadIndex] = true;
     mFrameHeadIndex = nextIndex(mFrameHeadIndex);
     return frame;
@@ -134,6 +232,8 @@ void SubtitleFrameQueue::reset() {
     }
     mFrames = NULL;
     mFrameInvalidated = NULL;
+    mDirtyRects.clear();
+    mDamage.clear();
     mCapacity = 0;
     mFrameNextIndex = 0;
     mFrameHeadIndex = 0;
@@ -8,10 +8,25 @@ extern "C" {
 
 #include <vector>
 #include <atomic>
+#include <algorithm>
 #include <android/log.h>
 
 class SubtitleFrameQueue {
 public:
+    struct Rect {
+        int x;
+        int y;
+        int width;
+        int height;
+
+        bool isEmpty() const {
+            return width <= 0 || height <= 0;
+        }
+
+        // Grow this rect to also cover the other one
+        void unite(const Rect& other);
+    };
+
     SubtitleFrameQueue();
     ~SubtitleFrameQueue();
 
@@ -19,11 +34,24 @@ public:
 
     AVFrame* getNextFrame(int64_t pts);
 
+    /**
+     * Marks areas of the next frame that subtitles were drawn to. Only these areas are cleared
+     * when the frame is reused instead of the whole frame.
+     */
+    void addDirtyRects(const std::vector<Rect>& rects);
+
+    /**
+     * Sets the area of the next frame that differs from the frame pushed before it, the rest can
+     * be kept from the previously shown frame
+     */
+    void setNextFrameDamage(const Rect& damage);
+
     AVFrame* getFirstFrame();
 
     int pushNextFrame();
 
-    AVFrame* dequeue();
+    // Optionally returns the damage of the removed frame
+    AVFrame* dequeue(Rect* outDamage = NULL);
 
     bool isEmpty();
 
@@ -38,9 +66,12 @@ public:
 private:
     void reset();
     int nextIndex(int index);
+    void clearDirtyRects(int index);
 
     AVFrame** mFrames;
     bool* mFrameInvalidated;
+    std::vector<std::vector<Rect>> mDirtyRects;
+    std::vector<Rect> mDamage;
     size_t mCapacity;
     std::atomic<int> mFrameNextIndex;
     std::atomic<int> mFrameHeadIndex;
@@ -1,34 +1,49 @@
 #include "SubtitleStream.h"
 #include "SSAHandler.h"
 #include "ImageSubHandler.h"
+#include <cinttypes>
 
 #define VIDEO_PIC_QUEUE_SIZE 4
 #define DEFAULT_FRAME_WIDTH 640
 #define DEFAULT_FRAME_HEIGHT 480
 
+// Requests beyond this are merged into the newest one, the video thread is not this far ahead
+#define MAX_RENDER_REQUESTS VIDEO_PIC_QUEUE_SIZE
+
+// Without requests for this long the render thread renders upcoming subtitles ahead of time
+#define PRERENDER_IDLE_MS 20
+
 static const char* sTag = "SubtitleStream";
 
 #define _log(...) __android_log_print(ANDROID_LOG_INFO, sTag, __VA_ARGS__);
 
-static bool isTextSub(AVCodecID id) {
-    return id == AV_CODEC_ID_ASS || id == AV_CODEC_ID_SRT || id == AV_CODEC_ID_TEXT;
-}
-
 SubtitleStream::SubtitleStream(AVFormatContext* context, AVPacket* flushPkt, ICallback* callback) :
         StreamComponent(context, AVMEDIA_TYPE_SUBTITLE, flushPkt, callback),
         mHandler(NULL),
+        mTrackCache(new SubtitleTrackCache(context)),
         mFrameQueue(NULL),
+        mPendingDamage({0, 0, 0, 0}),
+        mRenderThread(NULL),
+        mRenderAborted(false),
+        mRenderFlushPending(false),
         mPendingWidth(0),
         mPendingHeight(0),
         mPendingFontPath(NULL),
-        mPendingFontFamily(NULL) {
+        mPendingFontFamily(NULL),
+        mCacheBudget(0),
+        mPendingCacheBudget(-1) {
 }
 
 SubtitleStream::~SubtitleStream() {
+    stopRenderThread();
     if (mHandler) {
         delete mHandler;
         mHandler = NULL;
     }
+    if (mTrackCache) {
+        delete mTrackCache;
+        mTrackCache = NULL;
+    }
     if (mFrameQueue) {
         delete mFrameQueue;
         mFrameQueue = NULL;
@@ -39,49 +54,114 @@ void SubtitleStream::abort() {
     if (mHandler) {
         mHandler->abort();
     }
+    {
+        std::lock_guard<std::mutex> lk(mRenderMutex);
+        mRenderAborted = true;
+    }
+    mRenderCondition.notify_all();
     StreamComponent::abort();
 }
 
+void SubtitleStream::requestSubtitleFrame(int64_t pts, double clockPts, bool force) {
+    spawnRenderThreadIfHaveNot();
+    {
+        std::lock_guard<std::mutex> lk(mRenderMutex);
+        if (mRenderRequests.size() >= MAX_RENDER_REQUESTS) {
+            // Render thread fell behind, the newest requests are kept on purpose instead of
+            // blocking the decoder. The frame shown takes the newest overlay up to its pts, so the
+            // skipped one would only have been on screen until the next is ready
+            __android_log_print(ANDROID_LOG_VERBOSE, sTag,
+                                "Skip subtitle render request %" PRId64,
+                                mRenderRequests.front().pts);
+            force |= mRenderRequests.front().force;
+            mRenderRequests.pop_front();
+        }
+        mRenderRequests.push_back({pts, clockPts, force});
+    }
+    mRenderCondition.notify_one();
+}
+
 int SubtitleStream::prepareSubtitleFrame(int64_t pts, double clockPts, bool force) {
     int ret = ensureQueue();
     if (ret < 0) {
         return ret;
     }
 
+    // Wait for the video renderer to show the frames already rendered ahead
+    {
+        std::unique_lock<std::mutex> lk(mRenderMutex);
+        mRenderCondition.wait(lk, [this] {
+            return mRenderAborted || mRenderFlushPending || !mFrameQueue->isFull();
+        });
+        if (mRenderAborted || mRenderFlushPending) {
+            return 0;
+        }
+    }
+
     AVFrame *subTmpFrame = mFrameQueue->getNextFrame(pts);
-    if ((ret = blendToFrame(subTmpFrame, clockPts, force)) < 0) {
+    SubtitleFrameQueue::Rect damage = {0, 0, 0, 0};
+    mDirtyRects.clear();
+    ret = blendToFrame(subTmpFrame, clockPts, force, &mDirtyRects, &damage);
+    mFrameQueue->addDirtyRects(mDirtyRects);
+    if (ret < 0) {
         __android_log_print(ANDROID_LOG_WARN, sTag, "Failed to blend subs to sub videoFrame");
     } else if (ret > 0) {
         // Has Changed, add it to the list
+        mFrameQueue->setNextFrameDamage(damage);
         mFrameQueue->pushNextFrame();
     }
     return 0;
 }
 
-AVFrame *SubtitleStream::getPendingSubtitleFrame(int64_t pts) {
-    int ret = ensureQueue();
-    if (ret < 0) {
+AVFrame *SubtitleStream::getPendingSubtitleFrame(int64_t pts,
+                                                SubtitleFrameQueue::Rect* outDamage) {
+    // Only the render thread creates and resizes the queue
+    if (mFrameQueue == NULL || mFrameQueue->getWidth() <= 0 || mFrameQueue->getHeight() <= 0) {
         return NULL;
     }
 
     AVFrame *subFrame = NULL;
+    SubtitleFrameQueue::Rect damage;
     while (mFrameQueue->getFirstFrame()) {
         AVFrame *f = mFrameQueue->getFirstFrame();
         if (f == NULL || f->pts > pts) {
             break;
         }
-        subFrame = mFrameQueue->dequeue();
+        subFrame = mFrameQueue->dequeue(&damage);
+        mPendingDamage.unite(damage);
+    }
+    if (subFrame) {
+        if (outDamage) {
+            *outDamage = mPendingDamage;
+            mPendingDamage = {0, 0, 0, 0};
+        }
+
+        // Wake the render thread if it waits for room, lock so the wake up is not missed
+        {
+            std::lock_guard<std::mutex> lk(mRenderMutex);
+        }
+        mRenderCondition.notify_all();
     }
     return subFrame;
 }
 
-int SubtitleStream::blendToFrame(AVFrame *vFrame, double clockPts, bool force) {
+int SubtitleStream::blendToFrame(AVFrame *vFrame, double clockPts, bool force,
+                                 std::vector<SubtitleFrameQueue::Rect>* outDirtyRects,
+                                 SubtitleFrameQueue::Rect* outDamage) {
     if (mHandler) {
         if (mPendingFontPath && mPendingFontFamily) {
             mHandler->setDefaultFont(mPendingFontPath, mPendingFontFamily);
         }
         mPendingFontPath = mPendingFontFamily = NULL;
-        return mHandler->blendToFrame(clockPts, vFrame, mPacketQueue->serial(), force);
+
+        // Handlers free cached images when the budget shrinks, only do it where they are used
+        const int budget = mPendingCacheBudget.exchange(-1);
+        if (budget >= 0) {
+            mCacheBudget = budget;
+            mHandler->setCacheBudget(budget);
+        }
+        return mHandler->blendToFrame(clockPts, vFrame, mPacketQueue->serial(), force,
+                                      outDirtyRects, outDamage);
     }
     return 0;
 }
@@ -109,25 +189,77 @@ void SubtitleStream::setDefaultFont(const char *fontPath, const char *fontFamily
     mPendingFontFamily = fontFamily;
 }
 
+void SubtitleStream::setCacheBudget(int megabytes) {
+    mPendingCacheBudget = std::max(megabytes, 0);
+}
+
+bool SubtitleStream::getYUVPlanes(const AVFrame *frame, alphablend::YUVPlanes *outPlanes) {
+    bool fullRange = false;
+    switch (frame->format) {
+        case AV_PIX_FMT_YUVJ420P:
+        case AV_PIX_FMT_YUVJ422P:
+        case AV_PIX_FMT_YUVJ444P:
+            fullRange = true;
+            // Fall through
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_YUV422P:
+        case AV_PIX_FMT_YUV444P:
+            break;
+        default:
+            return false;
+    }
+    const AVPixFmtDescriptor* descriptor = av_pix_fmt_desc_get((AVPixelFormat) frame->format);
+    for (int i = 0; i < 3; i++) {
+        if (frame->linesize[i] < 0) {
+            return false;
+        }
+        outPlanes->data[i] = frame->data[i];
+        outPlanes->linesize[i] = (size_t) frame->linesize[i];
+    }
+    outPlanes->chromaShiftX = descriptor->log2_chroma_w;
+    outPlanes->chromaShiftY = descriptor->log2_chroma_h;
+    outPlanes->fullRange = fullRange || frame->color_range == AVCOL_RANGE_JPEG;
+    return true;
+}
+
+bool SubtitleStream::feedBackgroundPacket(AVPacket *pkt) {
+    return mTrackCache->feedPacket(pkt);
+}
+
+void SubtitleStream::flushBackgroundTracks() {
+    mTrackCache->flush();
+}
+
 int SubtitleStream::open() {
+    stopRenderThread();
     int ret = StreamComponent::open();
     if (!ret) {
+        // Previous stream's decoding thread has ended, parse its track in the background again
+        mTrackCache->detach();
+
         // Only create a handler if not exists or previous handler is still same type
-        if (isTextSub(mCContext->codec_id)) {
-            if (mHandler == NULL || !isTextSub(mHandler->codec_id)) {
-                mHandler = new SSAHandler(mCContext->codec_id);
+        if (SubtitleTrackCache::isTextSub(mCContext->codec_id)) {
+            if (mHandler == NULL || !SubtitleTrackCache::isTextSub(mHandler->codec_id)) {
+                delete mHandler;
+                mHandler = new SSAHandler(mCContext->codec_id, mTrackCache);
             }
-        } else if (mHandler == NULL || isTextSub(mHandler->codec_id)) {
+        } else if (mHandler == NULL || SubtitleTrackCache::isTextSub(mHandler->codec_id)) {
+            delete mHandler;
             mHandler = new ImageSubHandler(mCContext->codec_id);
         }
 
         if (mHandler) {
-            if ((ret = mHandler->open(mCContext, mFContext)) < 0) {
+            if ((ret = mHandler->open(mCContext, mFContext, mStreamIndex)) < 0) {
                 __android_log_print(ANDROID_LOG_WARN, sTag, "Cannot open subtitles handler, skip");
                 delete mHandler;
                 mHandler = NULL;
                 return ret;
             }
+            const int budget = mPendingCacheBudget.exchange(-1);
+            if (budget >= 0) {
+                mCacheBudget = budget;
+            }
+            mHandler->setCacheBudget(mCacheBudget);
         } else {
             __android_log_print(ANDROID_LOG_WARN, sTag, "No subtitle handler for type %d",
                                 mCContext->codec_id);
@@ -150,7 +282,22 @@ void SubtitleStream::onDecodeFrame(void* frame, AVPacket *pkt, int *ret) {
 }
 
 void SubtitleStream::onDecodeFlushBuffers() {
-    if (mFrameQueue->getWidth() > 0 && mFrameQueue->getHeight() > 0) {
+    {
+        // Requests before seeking are stale, the render thread owns the queue so let it flush
+        std::lock_guard<std::mutex> lk(mRenderMutex);
+        mRenderRequests.clear();
+        mRenderFlushPending = mRenderThread != NULL;
+    }
+    if (mRenderThread) {
+        mRenderCondition.notify_one();
+    } else {
+        flushFrameQueue();
+    }
+    mHandler->flush();
+}
+
+void SubtitleStream::flushFrameQueue() {
+    if (mFrameQueue && mFrameQueue->getWidth() > 0 && mFrameQueue->getHeight() > 0) {
         // Remove all items when flushing if queue has been sized
         while (mFrameQueue->getFirstFrame()) {
             mFrameQueue->dequeue();
@@ -158,9 +305,80 @@ void SubtitleStream::onDecodeFlushBuffers() {
 
         // Push empty frame to erase the subtitles
         mFrameQueue->getNextFrame(0);
+        mFrameQueue->setNextFrameDamage({0, 0, mFrameQueue->getWidth(),
+                                         mFrameQueue->getHeight()});
         mFrameQueue->pushNextFrame();
     }
-    mHandler->flush();
+}
+
+void SubtitleStream::spawnRenderThreadIfHaveNot() {
+    if (!mRenderThread) {
+        mRenderAborted = false;
+        mRenderFlushPending = false;
+        mRenderThread = new std::thread(&SubtitleStream::onRenderThread, this);
+    }
+}
+
+void SubtitleStream::stopRenderThread() {
+    if (mRenderThread) {
+        {
+            std::lock_guard<std::mutex> lk(mRenderMutex);
+            mRenderAborted = true;
+        }
+        mRenderCondition.notify_all();
+        __android_log_print(ANDROID_LOG_VERBOSE, sTag, "Join subtitle render thread");
+        mRenderThread->join();
+        delete mRenderThread;
+        mRenderThread = NULL;
+    }
+    mRenderRequests.clear();
+}
+
+void SubtitleStream::onRenderThread() {
+    IPlayerCallback::UniqueCallback unCallback(mPlayerCallback);
+    __android_log_print(ANDROID_LOG_VERBOSE, sTag, "Subtitle render thread started");
+    bool canPrerender = false;
+    while (1) {
+        RenderRequest request;
+        bool flush = false;
+        bool idle = false;
+        {
+            std::unique_lock<std::mutex> lk(mRenderMutex);
+            auto hasWork = [this] {
+                return mRenderAborted || mRenderFlushPending || !mRenderRequests.empty();
+            };
+            if (canPrerender) {
+                idle = !mRenderCondition.wait_for(lk, std::chrono::milliseconds(PRERENDER_IDLE_MS),
+                                                  hasWork);
+            } else {
+                mRenderCondition.wait(lk, hasWork);
+            }
+            if (mRenderAborted) {
+                break;
+            }
+            if (!idle) {
+                flush = mRenderFlushPending;
+                mRenderFlushPending = false;
+                if (!flush) {
+                    request = mRenderRequests.front();
+                    mRenderRequests.pop_front();
+                }
+            }
+        }
+        if (idle) {
+            // Keep going until the handler has nothing close enough to render
+            canPrerender = mHandler != NULL && mHandler->prerender();
+        } else if (flush) {
+            flushFrameQueue();
+            canPrerender = false;
+        } else {
+            if (prepareSubtitleFrame(request.pts, request.clockPts, request.force) < 0) {
+                __android_log_print(ANDROID_LOG_WARN, sTag, "Failed to prepare subtitle frames");
+            }
+            canPrerender = true;
+        }
+    }
+    __android_log_print(ANDROID_LOG_VERBOSE, sTag, "Subtitle render thread ended");
 }
 
 bool SubtitleStream::areFramesPending() {
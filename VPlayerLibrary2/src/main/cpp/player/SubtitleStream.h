@@ -1,8 +1,12 @@
 #ifndef SUBTITLESTREAM_H
 #define SUBTITLESTREAM_H
 
+#include <atomic>
+#include <deque>
 #include "StreamComponent.h"
 #include "SubtitleFrameQueue.h"
+#include "SubtitleTrackCache.h"
+#include "blend.h"
 
 // TODO make this base class, have SSA and image (pgs) subs into subclasses
 class SubtitleStream : public StreamComponent {
@@ -12,13 +16,29 @@ public:
     public:
         SubtitleHandlerBase(AVCodecID codecID) : codec_id(codecID) {}
         virtual ~SubtitleHandlerBase() {}
-        virtual int open(AVCodecContext* cContext, AVFormatContext* fContext) = 0;
+        virtual int open(AVCodecContext* cContext, AVFormatContext* fContext,
+                         int streamIndex) = 0;
         virtual void abort() = 0;
         virtual bool handleDecodedSubtitle(AVSubtitle *subtitle, intptr_t pktSerial) = 0;
-        virtual int blendToFrame(double pts, AVFrame *vFrame, intptr_t pktSerial, bool force) = 0;
+        /**
+         * Draw the subtitles shown at pts to the frame
+         * @param outDirtyRects if not null, each area drawn to is added to it
+         * @param outDamage if not null, set to the area that differs from the last frame drawn
+         * @return > 0 if the subtitles changed, 0 if not changed or < 0 for errors
+         */
+        virtual int blendToFrame(double pts, AVFrame *vFrame, intptr_t pktSerial, bool force,
+                                 std::vector<SubtitleFrameQueue::Rect>* outDirtyRects,
+                                 SubtitleFrameQueue::Rect* outDamage) = 0;
         virtual void setDefaultFont(const char* fontPath, const char* fontFamily) = 0;
+        // Memory for cached glyphs and subtitle images, 0 uses the default
+        virtual void setCacheBudget(int megabytes) = 0;
         virtual AVSubtitle* getSubtitle() = 0;
         virtual bool areFramesPending() = 0;
+        /**
+         * Called on the render thread when it is idle to render upcoming subtitles ahead of time
+         * @return true if something was rendered and it can be called again
+         */
+        virtual bool prerender() = 0;
         virtual void invalidateFrame() = 0;
         virtual void flush() = 0;
 
@@ -30,15 +50,40 @@ public:
 
     virtual void abort() override;
 
-    // If subtitle stream is handling its own frame, use these functions to prepare and get it
-    int prepareSubtitleFrame(int64_t pts, double clockPts, bool force = false);
-    AVFrame* getPendingSubtitleFrame(int64_t pts);
+    // If subtitle stream is handling its own frame, use these functions to prepare and get it.
+    // Frames are rendered on the subtitle render thread ahead of when the video frame is shown
+    void requestSubtitleFrame(int64_t pts, double clockPts, bool force = false);
+
+    /**
+     * Take the newest rendered frame to show at pts, older frames are dropped
+     * @param outDamage if not null, set to the area that changed since the last frame taken with
+     *                  a damage rect, includes the changes of frames dropped in between
+     */
+    AVFrame* getPendingSubtitleFrame(int64_t pts, SubtitleFrameQueue::Rect* outDamage = NULL);
 
     // If you want to merge the subs into an existing frame use this
-    int blendToFrame(AVFrame* vFrame, double clockPts, bool force = false);
+    int blendToFrame(AVFrame* vFrame, double clockPts, bool force = false,
+                     std::vector<SubtitleFrameQueue::Rect>* outDirtyRects = NULL,
+                     SubtitleFrameQueue::Rect* outDamage = NULL);
 
     void setFrameSize(int width, int height);
     void setDefaultFont(const char* fontPath, const char* fontFamily);
+    // Applied on the next blend, the handler's caches are only touched from there
+    void setCacheBudget(int megabytes);
+
+    /**
+     * Handlers blend straight into 8 bit planar yuv frames, any other frame is treated as RGBA
+     * @return false if subtitles cannot be blended into this format of frame
+     */
+    static bool getYUVPlanes(const AVFrame* frame, alphablend::YUVPlanes* outPlanes);
+
+    /**
+     * Parse packets of text subtitle streams that are not picked so they can be switched to
+     * without waiting for their packets to be read again
+     * @return true if the packet was used, the caller still owns it
+     */
+    bool feedBackgroundPacket(AVPacket* pkt);
+    void flushBackgroundTracks();
 
 protected:
     int open() override;
@@ -51,16 +96,43 @@ protected:
     bool areFramesPending() override;
 
 private:
+    struct RenderRequest {
+        int64_t pts;
+        double clockPts;
+        bool force;
+    };
+
     int ensureQueue();
+    int prepareSubtitleFrame(int64_t pts, double clockPts, bool force);
+    void flushFrameQueue();
+    void spawnRenderThreadIfHaveNot();
+    void stopRenderThread();
+    void onRenderThread();
 
     SubtitleHandlerBase* mHandler;
+    SubtitleTrackCache* mTrackCache;
     SubtitleFrameQueue* mFrameQueue;
+    std::vector<SubtitleFrameQueue::Rect> mDirtyRects;
+
+    // Changes of subtitle frames taken off the queue but not shown yet
+    SubtitleFrameQueue::Rect mPendingDamage;
+
+    // Render thread variables
+    std::thread* mRenderThread;
+    std::mutex mRenderMutex;
+    std::condition_variable mRenderCondition;
+    std::deque<RenderRequest> mRenderRequests;
+    bool mRenderAborted;
+    bool mRenderFlushPending;
 
     int mPendingWidth;
     int mPendingHeight;
 
     const char* mPendingFontPath;
     const char* mPendingFontFamily;
+    int mCacheBudget;
+    // Budget set since the handler last applied it, -1 if none
+    std::atomic<int> mPendingCacheBudget;
 };
 
 #endif //SUBTITLESTREAM_H
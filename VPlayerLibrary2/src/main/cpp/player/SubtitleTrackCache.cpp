@@ -0,0 +1,165 @@
+#include "SubtitleTrackCache.h"
+#include "ASSLibraryCache.h"
+
+static const char* sTag = "SubtitleTrackCache";
+
+SubtitleTrackCache::SubtitleTrackCache(AVFormatContext *context) :
+        mFContext(context),
+        mAttachedIndex(-1) {
+    int numOfTextStreams = 0;
+    for (unsigned int i = 0; i < context->nb_streams; i++) {
+        const AVCodecParameters* par = context->streams[i]->codecpar;
+        if (par->codec_type == AVMEDIA_TYPE_SUBTITLE && isTextSub(par->codec_id)) {
+            numOfTextStreams++;
+        }
+    }
+
+    // Streams that are not picked are discarded by the demuxer, read them for the background
+    if (numOfTextStreams > 1) {
+        for (unsigned int i = 0; i < context->nb_streams; i++) {
+            const AVCodecParameters* par = context->streams[i]->codecpar;
+            if (par->codec_type == AVMEDIA_TYPE_SUBTITLE && isTextSub(par->codec_id)) {
+                context->streams[i]->discard = AVDISCARD_DEFAULT;
+            }
+        }
+    }
+}
+
+SubtitleTrackCache::~SubtitleTrackCache() {
+    for (auto& it : mEntries) {
+        if (it.second.context) {
+            avcodec_free_context(&it.second.context);
+        }
+        if (it.second.track) {
+            ass_free_track(it.second.track);
+        }
+    }
+    mEntries.clear();
+}
+
+bool SubtitleTrackCache::isTextSub(AVCodecID id) {
+    return id == AV_CODEC_ID_ASS || id == AV_CODEC_ID_SRT || id == AV_CODEC_ID_TEXT;
+}
+
+ASS_Track *SubtitleTrackCache::attach(int streamIndex, AVCodecContext *cContext,
+                                      bool *outHasEvents) {
+    std::lock_guard<std::mutex> lk(mMutex);
+    mAttachedIndex = -1;
+    auto it = mEntries.find(streamIndex);
+    if (it == mEntries.end()) {
+        it = mEntries.insert({streamIndex, {NULL, NULL}}).first;
+    }
+    Entry& entry = it->second;
+    if (!entry.track && !(entry.track = createTrack(cContext))) {
+        return NULL;
+    }
+    if (outHasEvents) {
+        *outHasEvents = entry.track->n_events > 0;
+    }
+    mAttachedIndex = streamIndex;
+    return entry.track;
+}
+
+void SubtitleTrackCache::detach() {
+    std::lock_guard<std::mutex> lk(mMutex);
+    mAttachedIndex = -1;
+}
+
+bool SubtitleTrackCache::feedPacket(AVPacket *pkt) {
+    if (pkt->stream_index < 0 || (unsigned int) pkt->stream_index >= mFContext->nb_streams) {
+        return false;
+    }
+    const AVCodecParameters* par = mFContext->streams[pkt->stream_index]->codecpar;
+    if (par->codec_type != AVMEDIA_TYPE_SUBTITLE || !isTextSub(par->codec_id)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lk(mMutex);
+    if (pkt->stream_index == mAttachedIndex) {
+        return false;
+    }
+    Entry& entry = mEntries.insert({pkt->stream_index, {NULL, NULL}}).first->second;
+    if (!entry.context && openDecoder(pkt->stream_index, &entry.context) < 0) {
+        return false;
+    }
+    if (!entry.track && !(entry.track = createTrack(entry.context))) {
+        return false;
+    }
+
+    AVSubtitle subtitle;
+    int gotSubtitle = 0;
+    if (avcodec_decode_subtitle2(entry.context, &subtitle, &gotSubtitle, pkt) >= 0
+            && gotSubtitle) {
+        if (subtitle.format == 1) {
+            for (unsigned int i = 0; i < subtitle.num_rects; i++) {
+                char* text = subtitle.rects[i]->ass;
+                ass_process_data(entry.track, text, (int) strlen(text));
+            }
+        }
+        avsubtitle_free(&subtitle);
+    }
+    return true;
+}
+
+void SubtitleTrackCache::flush() {
+    std::lock_guard<std::mutex> lk(mMutex);
+    for (auto& it : mEntries) {
+        if (it.first == mAttachedIndex) {
+            // Flushed by the handler when it receives the flush packet
+            continue;
+        }
+        if (it.second.context) {
+            avcodec_flush_buffers(it.second.context);
+        }
+        if (it.second.track) {
+            ass_flush_events(it.second.track);
+        }
+    }
+}
+
+int SubtitleTrackCache::openDecoder(int streamIndex, AVCodecContext **outContext) {
+    int ret;
+    const AVStream* stream = mFContext->streams[streamIndex];
+    AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec) {
+        __android_log_print(ANDROID_LOG_WARN, sTag, "Cannot find a codec for id: %d",
+                            stream->codecpar->codec_id);
+        return AVERROR(EINVAL);
+    }
+    AVCodecContext* context = avcodec_alloc_context3(NULL);
+    if (!context) {
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = avcodec_parameters_to_context(context, stream->codecpar)) < 0) {
+        avcodec_free_context(&context);
+        return ret;
+    }
+    context->pkt_timebase = stream->time_base;
+    if ((ret = avcodec_open2(context, codec, NULL)) < 0) {
+        __android_log_print(ANDROID_LOG_WARN, sTag, "Cannot open background subtitle decoder");
+        avcodec_free_context(&context);
+        return ret;
+    }
+    *outContext = context;
+    return 0;
+}
+
+ASS_Track *SubtitleTrackCache::createTrack(AVCodecContext *cContext) {
+    ASSLibraryCache& cache = ASSLibraryCache::get();
+    if (!cache.library()) {
+        return NULL;
+    }
+
+    // Embedded fonts in the header are extracted into the shared library
+    std::unique_lock<std::shared_timed_mutex> lk(cache.lock());
+    ASS_Track* track = ass_new_track(cache.library());
+    if (!track) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot allocate ass track");
+        return NULL;
+    }
+    if (cContext->subtitle_header) {
+        ass_process_codec_private(track, (char*) cContext->subtitle_header,
+                                  cContext->subtitle_header_size);
+    }
+    return track;
+}
@@ -0,0 +1,60 @@
+#ifndef SUBTITLETRACKCACHE_H
+#define SUBTITLETRACKCACHE_H
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+#include <ass/ass.h>
+#include <android/log.h>
+#include <map>
+#include <mutex>
+
+/**
+ * Keeps an ASS track for every text subtitle stream in the file. The track of the selected stream
+ * is attached to the subtitle handler and fed by the subtitle decoding thread, the others are fed
+ * from the read thread in the background so switching to them shows their subtitles immediately.
+ */
+class SubtitleTrackCache {
+public:
+    SubtitleTrackCache(AVFormatContext* context);
+    ~SubtitleTrackCache();
+
+    static bool isTextSub(AVCodecID id);
+
+    /**
+     * Take the track of the stream to render and feed it from the decoding thread, the previously
+     * attached track goes back to being fed in the background
+     * @param cContext decoder of the stream, creates the track from its header if not parsed yet
+     * @param outHasEvents set to true if the track already has subtitles parsed in the background
+     * @return the track, NULL if it cannot be allocated
+     */
+    ASS_Track* attach(int streamIndex, AVCodecContext* cContext, bool* outHasEvents);
+
+    // Let the background take over the attached track again
+    void detach();
+
+    /**
+     * Parse a packet of a text subtitle stream that is not attached
+     * @return true if the packet was used, the caller still owns it
+     */
+    bool feedPacket(AVPacket* pkt);
+
+    // Remove the events of the background tracks when seeking, they are read again from there
+    void flush();
+
+private:
+    struct Entry {
+        AVCodecContext* context;
+        ASS_Track* track;
+    };
+
+    int openDecoder(int streamIndex, AVCodecContext** outContext);
+    ASS_Track* createTrack(AVCodecContext* cContext);
+
+    AVFormatContext* mFContext;
+    std::mutex mMutex;
+    std::map<int, Entry> mEntries;
+    int mAttachedIndex;
+};
+
+#endif //SUBTITLETRACKCACHE_H
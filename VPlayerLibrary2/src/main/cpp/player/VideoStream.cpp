@@ -9,12 +9,71 @@
 
 #define AV_SYNC_THRESHOLD(X) FFMAX(AV_SYNC_THRESHOLD_MIN, FFMIN(AV_SYNC_THRESHOLD_MAX, X))
 
+// H.264 nal unit types of coded slices, IDR (5) is always a reference
+#define H264_NAL_SLICE 1
+#define H264_NAL_IDR_SLICE 5
+
 #define REFRESH_RATE 0.01
+
+// Playing faster decodes more frames per second, start from lower decoding quality at these speeds
+#define FAST_PLAYBACK_SPEED 1.5
+#define FASTER_PLAYBACK_SPEED 2.0
 #define BUFFER_STRING_LENGTH 64
 #define _log(...) __android_log_print(ANDROID_LOG_INFO, "VideoStream", __VA_ARGS__);
 
 static const char* sTag = "VideoStream";
 
+/**
+ * Checks the header byte of a H.264 nal unit
+ * @return false if the nal unit is a slice that other frames reference
+ */
+static bool isH264NalNonReference(uint8_t header, bool* hasSlice) {
+    const int type = header & 0x1f;
+    if (type >= H264_NAL_SLICE && type <= H264_NAL_IDR_SLICE) {
+        *hasSlice = true;
+        return (header & 0x60) == 0;
+    }
+    return true;
+}
+
+/**
+ * Parses the nal units of a H.264 packet to see if no other frame depends on it
+ * @param nalLengthSize size of the length prefix of each nal unit (avcC), 0 for annex b
+ * @return true if the packet contains slices and all have a nal_ref_idc of 0
+ */
+static bool isH264NonReferencePacket(const uint8_t* data, int size, int nalLengthSize) {
+    bool hasSlice = false;
+    int i = 0;
+    if (nalLengthSize > 0) {
+        while (size - i > nalLengthSize) {
+            uint32_t length = 0;
+            for (int j = 0; j < nalLengthSize; j++) {
+                length = (length << 8) | data[i++];
+            }
+            if (length == 0 || length > (uint32_t) (size - i)) {
+                return false;
+            }
+            if (!isH264NalNonReference(data[i], &hasSlice)) {
+                return false;
+            }
+            i += length;
+        }
+    } else {
+        // Annex b, look at the byte after each start code
+        while (i + 3 < size) {
+            if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+                if (!isH264NalNonReference(data[i + 3], &hasSlice)) {
+                    return false;
+                }
+                i += 4;
+            } else {
+                i++;
+            }
+        }
+    }
+    return hasSlice;
+}
+
 VideoStream::VideoStream(AVFormatContext* context, AVPacket* flushPkt, ICallback* callback) :
         AVComponentStream(context, AVMEDIA_TYPE_VIDEO, flushPkt, callback, VIDEO_PIC_QUEUE_SIZE),
         mAllowDropFrames(true),
@@ -28,7 +87,13 @@ VideoStream::VideoStream(AVFormatContext* context, AVPacket* flushPkt, ICallback
         mEarlyFrameDrops(0),
         mMaxFrameDuration(0),
         mLateFrameDrops(0),
+        mLatePacketDrops(0),
+        mNalLengthSize(-1),
         mCanSupportNetworkControls(false),
+        mBlendSubtitlesInYUV(false),
+        mFrameWidth(0),
+        mFrameHeight(0),
+        mFramePixFormat(AV_PIX_FMT_NONE),
         mCSConverter(NULL) {
 }
 
@@ -50,6 +115,11 @@ void VideoStream::setPaused(bool paused) {
     AVComponentStream::setPaused(paused);
 }
 
+void VideoStream::setPlaybackSpeed(double speed) {
+    AVComponentStream::setPlaybackSpeed(speed);
+    mQualityController.setMinLevel(speed >= FASTER_PLAYBACK_SPEED ? 2
+                                   : speed >= FAST_PLAYBACK_SPEED ? 1 : 0);
+}
 
 void VideoStream::setVideoRenderer(IVideoRenderer *videoRenderer) {
     mVideoRenderer = videoRenderer;
@@ -68,6 +138,10 @@ void VideoStream::setSupportNetworkControls(bool flag) {
     mCanSupportNetworkControls = flag;
 }
 
+void VideoStream::setBlendSubtitlesInYUV(bool flag) {
+    mBlendSubtitlesInYUV = flag;
+}
+
 void VideoStream::invalidNextFrame() {
     mNextFrameWritten = false;
     mInvalidateSubs = true;
@@ -95,36 +169,50 @@ int VideoStream::open() {
         return ret;
     }
     mForceRefresh = false;
+    mQualityController.reset();
     mMaxFrameDuration = (mFContext->iformat->flags & AVFMT_TS_DISCONT) != 0 ? 10 : 3600;
+    mLatePacketDrops = 0;
+
+    // H.264 packets are either avcC (extradata starts with version 1) with length prefixed nal
+    // units or annex b with start codes, other codecs only rely on the disposable flag
+    mNalLengthSize = -1;
+    if (mCContext->codec_id == AV_CODEC_ID_H264) {
+        mNalLengthSize = mCContext->extradata_size >= 7 && mCContext->extradata[0] == 1
+                         ? (mCContext->extradata[4] & 0x3) + 1 : 0;
+    }
 
     // Init the pool to fit the size of the video frames
     if ((ret = mFramePool.resize(mQueue->capacity(), mCContext->width, mCContext->height,
                                  AV_PIX_FMT_RGBA)) < 0) {
         __android_log_print(ANDROID_LOG_ERROR, sTag, "Unable to create video frame pool");
     }
+    mFrameWidth = mCContext->width;
+    mFrameHeight = mCContext->height;
+    updateConverter(mCContext->pix_fmt);
+    return ret;
+}
 
-    // If higher than 8 bit, use a 16bit converter for faster conversion
-    const AVPixFmtDescriptor *descriptor = av_pix_fmt_desc_get(mCContext->pix_fmt);
+void VideoStream::updateConverter(enum AVPixelFormat format) {
     if (mCSConverter) {
         delete mCSConverter;
         mCSConverter = NULL;
     }
-    if (descriptor->comp->depth > 8) {
-        if (mCSConverter) {
-            delete mCSConverter;
-        }
+    mFramePixFormat = format;
 
+    // If higher than 8 bit, use a 16bit converter for faster conversion
+    const AVPixFmtDescriptor *descriptor = av_pix_fmt_desc_get(format);
+    if (descriptor && descriptor->comp->depth > 8) {
         // Only handling basic 10, 12 and 16 bit YUV data
         // 16 bit and big endian are untested, assuming from docs it will work, ffmpeg cannot encode
         // either options to test
-        switch (mCContext->pix_fmt) {
+        switch (format) {
             case AV_PIX_FMT_YUV420P16BE:
             case AV_PIX_FMT_YUV420P16LE:
             case AV_PIX_FMT_YUV420P10BE:
             case AV_PIX_FMT_YUV420P10LE:
             case AV_PIX_FMT_YUV420P12BE:
             case AV_PIX_FMT_YUV420P12LE:
-                mCSConverter = new YUV16to8Converter(mCContext, AV_PIX_FMT_YUV420P);
+                mCSConverter = new YUV16to8Converter(format, AV_PIX_FMT_YUV420P);
                 break;
             case AV_PIX_FMT_YUV422P16BE:
             case AV_PIX_FMT_YUV422P16LE:
@@ -132,7 +220,7 @@ int VideoStream::open() {
             case AV_PIX_FMT_YUV422P10LE:
             case AV_PIX_FMT_YUV422P12BE:
             case AV_PIX_FMT_YUV422P12LE:
-                mCSConverter = new YUV16to8Converter(mCContext, AV_PIX_FMT_YUV422P);
+                mCSConverter = new YUV16to8Converter(format, AV_PIX_FMT_YUV422P);
                 break;
             case AV_PIX_FMT_YUV444P16BE:
             case AV_PIX_FMT_YUV444P16LE:
@@ -140,19 +228,36 @@ int VideoStream::open() {
             case AV_PIX_FMT_YUV444P10LE:
             case AV_PIX_FMT_YUV444P12LE:
             case AV_PIX_FMT_YUV444P12BE:
-                mCSConverter = new YUV16to8Converter(mCContext, AV_PIX_FMT_YUV444P);
+                mCSConverter = new YUV16to8Converter(format, AV_PIX_FMT_YUV444P);
                 break;
             default:
                 __android_log_print(ANDROID_LOG_WARN, sTag,
                                     "Cannot process 9-16 bit of pix format %s, using slow routine",
-                                    av_get_pix_fmt_name(mCContext->pix_fmt));
+                                    av_get_pix_fmt_name(format));
                 break;
         }
     }
     if (mCSConverter == NULL) {
         mCSConverter = new BasicYUVConverter();
     }
-    return ret;
+}
+
+void VideoStream::onFrameFormatChanged(AVFrame *frame) {
+    __android_log_print(ANDROID_LOG_INFO, sTag, "Video frame changed from %dx%d %s to %dx%d %s",
+                        mFrameWidth, mFrameHeight, av_get_pix_fmt_name(mFramePixFormat),
+                        frame->width, frame->height,
+                        av_get_pix_fmt_name((enum AVPixelFormat) frame->format));
+
+    // Pool buffers are refit when acquired, queued frames keep their buffers till shown
+    if (frame->width != mFrameWidth || frame->height != mFrameHeight) {
+        mFrameWidth = frame->width;
+        mFrameHeight = frame->height;
+        mFramePool.setFrameFormat(mFrameWidth, mFrameHeight, AV_PIX_FMT_RGBA);
+        mInvalidateSubs = true;
+    }
+    if (frame->format != mFramePixFormat) {
+        updateConverter((enum AVPixelFormat) frame->format);
+    }
 }
 
 AVDictionary *VideoStream::getPropertiesOfStream(AVCodecContext* cContext, AVStream* stream,
@@ -187,6 +292,54 @@ void VideoStream::onAVFrameReceived(AVFrame *frame) {
     frame->pts = frame->best_effort_timestamp;
 }
 
+void VideoStream::onDecodeFlushBuffers() {
+    mQualityController.flush();
+}
+
+void VideoStream::onDecodeFrame(void *frame, AVPacket *pkt, int *outRetCode) {
+    // Frames that are already late and not referenced are dropped here instead of decoding them
+    // only to drop them afterwards
+    if (canDropLatePacket(pkt)) {
+        mLatePacketDrops++;
+        __android_log_print(ANDROID_LOG_VERBOSE, sTag,
+                            "Late packet dropped before decoding (Count: %d)", mLatePacketDrops);
+        if (mSubStream) {
+            mSubStream->getPendingSubtitleFrame(pkt->pts);
+        }
+        return;
+    }
+    AVComponentStream::onDecodeFrame(frame, pkt, outRetCode);
+}
+
+bool VideoStream::isDisposablePacket(const AVPacket *pkt) {
+    if (pkt->flags & AV_PKT_FLAG_KEY) {
+        return false;
+    }
+#ifdef AV_PKT_FLAG_DISPOSABLE
+    if (pkt->flags & AV_PKT_FLAG_DISPOSABLE) {
+        return true;
+    }
+#endif
+    if (mNalLengthSize >= 0 && pkt->data && pkt->size > 0) {
+        return isH264NonReferencePacket(pkt->data, pkt->size, mNalLengthSize);
+    }
+    return false;
+}
+
+bool VideoStream::canDropLatePacket(const AVPacket *pkt) {
+    // Same conditions as the early frame drop in the decoding thread
+    if (pkt->pts == AV_NOPTS_VALUE || !allowFrameDrops() || mCallback->inFrameStepMode()
+            || mPktSerial != mClock->serial() || !mPacketQueue->numPackets()) {
+        return false;
+    }
+    double diff = (av_q2d(getStream()->time_base) * pkt->pts)
+                  - (getMasterClock()->getPts() - mCallback->getAudioLatency());
+    if (isnan(diff) || diff >= 0 || fabs(diff) >= AV_COMP_NOSYNC_THRESHOLD) {
+        return false;
+    }
+    return isDisposablePacket(pkt);
+}
+
 int VideoStream::onProcessThread() {
     __android_log_print(ANDROID_LOG_VERBOSE, sTag, "onProcessThread video started");
     AVFrame* avFrame = av_frame_alloc(), *rgbaFrame;
@@ -203,6 +356,12 @@ int VideoStream::onProcessThread() {
     while (1) {
         waitIfPaused();
 
+        // Lower or restore decoding quality depending on how far behind the decoder is
+        if (mQualityController.apply(mCContext)) {
+            __android_log_print(ANDROID_LOG_VERBOSE, sTag, "Decoding quality changed to level %d",
+                                mQualityController.level());
+        }
+
         // Get current frame and until error or abort
         if ((ret = decodeFrame(avFrame)) < 0) {
             if (ret != AVERROR_EXIT) {
@@ -221,6 +380,10 @@ int VideoStream::onProcessThread() {
             double audioLatency = mCallback->getAudioLatency();
             double diff = (av_q2d(stream->time_base) * avFrame->pts)
                           - (getMasterClock()->getPts() - audioLatency);
+            if (!isnan(diff) && fabs(diff) < AV_COMP_NOSYNC_THRESHOLD
+                    && mPktSerial == mClock->serial() && !mCallback->inFrameStepMode()) {
+                mQualityController.addLateness(-diff);
+            }
             if (!isnan(diff) && diff < 0 && fabs(diff) < AV_COMP_NOSYNC_THRESHOLD
                     && mPktSerial == mClock->serial()
                     && mPacketQueue->numPackets()) {
@@ -320,11 +483,40 @@ int VideoStream::onRenderThread() {
 
 int VideoStream::processVideoFrame(AVFrame* avFrame, AVFrame** outFrame) {
     int ret;
+
+    // Streams can change resolution or pixel format mid-stream (adaptive or broadcast streams)
+    if (avFrame->width != mFrameWidth || avFrame->height != mFrameHeight
+            || avFrame->format != mFramePixFormat) {
+        onFrameFormatChanged(avFrame);
+    }
+
     AVFrame* tmpFrame = mFramePool.acquire();
+    if (!tmpFrame) {
+        return error(AVERROR(ENOMEM), "Cannot acquire frame from video frame pool");
+    }
     tmpFrame->pts = avFrame->pts;
     tmpFrame->pkt_pos = avFrame->pkt_pos;
     tmpFrame->sample_aspect_ratio = avFrame->sample_aspect_ratio;
 
+    // Burned in subtitles are cheaper to blend into the smaller yuv planes before converting,
+    // frames the decoder still references are copied first so every yuv frame takes this path
+    const bool burnSubs = !hasAborted() && mSubStream
+                          && !(mVideoRenderer != NULL && mVideoRenderer->writeSubtitlesSeparately());
+    const double clockPts = getClock()->getPts();
+    alphablend::YUVPlanes planes;
+    bool subsBlended = false;
+    if (burnSubs && mBlendSubtitlesInYUV && SubtitleStream::getYUVPlanes(avFrame, &planes)) {
+        if ((ret = av_frame_make_writable(avFrame)) < 0) {
+            __android_log_print(ANDROID_LOG_WARN, sTag, "Cannot copy yuv frame to blend subs %d",
+                                ret);
+        } else {
+            if (mSubStream->blendToFrame(avFrame, clockPts, true) < 0) {
+                __android_log_print(ANDROID_LOG_WARN, sTag, "Failed to blend subs to yuv frame");
+            }
+            subsBlended = true;
+        }
+    }
+
     // Convert the frame to rgba
     if ((ret = mCSConverter->convert(avFrame, tmpFrame)) < 0) {
         return ret;
@@ -332,12 +524,10 @@ int VideoStream::processVideoFrame(AVFrame* avFrame, AVFrame** outFrame) {
 
     // Process the subtitle frame if it exists
     if (!hasAborted() && mSubStream) {
-        const double clockPts = getClock()->getPts();
-        if (mVideoRenderer != NULL && mVideoRenderer->writeSubtitlesSeparately()) {
-            if (mSubStream->prepareSubtitleFrame(avFrame->pts, clockPts, mInvalidateSubs) < 0) {
-                __android_log_print(ANDROID_LOG_WARN, sTag, "Failed to prepare subtitle frames");
-            }
-        } else {
+        if (!burnSubs) {
+            // Rendered on the subtitle thread while this frame waits in the queue
+            mSubStream->requestSubtitleFrame(avFrame->pts, clockPts, mInvalidateSubs);
+        } else if (!subsBlended) {
             // Blend to video video frame
             if (mSubStream->blendToFrame(tmpFrame, clockPts, true) < 0) {
                 __android_log_print(ANDROID_LOG_WARN, sTag, "Failed to blend subs to video frame");
@@ -384,9 +574,11 @@ int VideoStream::synchronizeVideo(double *remainingTime) {
                 break;
             }
 
-            // Calculate how off the video is from master clock
+            // Calculate how off the video is from master clock, stream time is converted to real
+            // time at the playback speed
+            const double speed = mPlaybackSpeed;
             lastDuration = getFrameDurationDiff(lastvp, vp);
-            delay = lastDuration;
+            delay = lastDuration / speed;
             if (!isMasterClock) {
                 double audioLatency = mCallback->getAudioLatency();
                 diff = mClock->getPts() - (getMasterClock()->getPts() - audioLatency);
@@ -395,6 +587,7 @@ int VideoStream::synchronizeVideo(double *remainingTime) {
                 // best guess
                 syncThres = AV_SYNC_THRESHOLD(delay);
                 if (!isnan(diff) && fabs(diff) < mMaxFrameDuration) {
+                    diff /= speed;
                     if (diff <= -syncThres) {
                         delay = FFMAX(0, delay + diff);
                     } else if (diff >= syncThres && delay > AV_SYNC_FRAMEDUP_THRESHOLD) {
@@ -428,10 +621,11 @@ int VideoStream::synchronizeVideo(double *remainingTime) {
             // Drop frames if processing is behind on render thread
             if (mQueue->getNumRemaining() > 1) {
                 Frame* nextvp = mQueue->peekNext();
-                duration = getFrameDurationDiff(vp, nextvp);
+                duration = getFrameDurationDiff(vp, nextvp) / speed;
                 if (!mCallback->inFrameStepMode() && allowFrameDrops()
                         && now > mFrameTimer + duration) {
                     mLateFrameDrops++;
+                    mQualityController.onLateFrameDropped();
                     __android_log_print(ANDROID_LOG_VERBOSE, sTag,
                                         "Late frame drop happened (Count: %d)", mLateFrameDrops);
                     mQueue->pushNext();
@@ -471,12 +665,13 @@ int VideoStream::writeFrameToRender(AVFrame* frame) {
 
     // If subtitles are written to a separate layer, get the pending frame
     AVFrame* subFrame = NULL;
+    SubtitleFrameQueue::Rect subDamage;
     if (mSubStream != NULL && mVideoRenderer->writeSubtitlesSeparately()) {
-        subFrame = mSubStream->getPendingSubtitleFrame(frame->pts);
+        subFrame = mSubStream->getPendingSubtitleFrame(frame->pts, &subDamage);
     }
 
     // Write frame (video and subtitles) to renderer
-    if ((ret = mVideoRenderer->writeFrame(frame, subFrame)) < 0) {
+    if ((ret = mVideoRenderer->writeFrame(frame, subFrame, subFrame ? &subDamage : NULL)) < 0) {
         return error(ret, "Was not able to write to video frame");
     }
     return ret;
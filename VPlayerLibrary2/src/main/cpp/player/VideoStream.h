@@ -8,6 +8,7 @@
 #include "SubtitleStream.h"
 #include "AvFramePool.h"
 #include "YUV16to8Converter.h"
+#include "DecoderQualityController.h"
 
 class VideoStream : public AVComponentStream {
 public:
@@ -16,6 +17,8 @@ public:
 
     void setPaused(bool paused) override;
 
+    void setPlaybackSpeed(double speed) override;
+
     void setVideoRenderer(IVideoRenderer* videoRenderer);
 
     void setVideoStreamCallback(IVideoStreamCallback* callback);
@@ -24,6 +27,9 @@ public:
 
     void setSupportNetworkControls(bool flag);
 
+    // Blend burned in subtitles into the decoded yuv frame instead of the converted rgba frame
+    void setBlendSubtitlesInYUV(bool flag);
+
     void invalidNextFrame();
 
     bool canEnqueueStreamPacket(const AVPacket& packet) override;
@@ -39,12 +45,18 @@ protected:
     int onProcessThread() override;
     int onRenderThread() override;
     void onAVFrameReceived(AVFrame *frame) override;
+    void onDecodeFlushBuffers() override;
+    void onDecodeFrame(void* frame, AVPacket* pkt, int* outRetCode) override;
 
     int open() override;
     AVDictionary* getPropertiesOfStream(AVCodecContext*, AVStream*, AVCodec*) override;
 
 private:
     int processVideoFrame(AVFrame* avFrame, AVFrame** outFrame);
+    void onFrameFormatChanged(AVFrame* frame);
+    void updateConverter(enum AVPixelFormat format);
+    bool isDisposablePacket(const AVPacket* pkt);
+    bool canDropLatePacket(const AVPacket* pkt);
     int synchronizeVideo(double *remainingTime);
     double getFrameDurationDiff(Frame* frame, Frame* nextFrame);
     void spawnRendererThreadIfHaveNot();
@@ -60,10 +72,17 @@ private:
     double mFrameTimer;
     int mEarlyFrameDrops;
     int mLateFrameDrops;
+    int mLatePacketDrops;
+    int mNalLengthSize;
     long mMaxFrameDuration;
     bool mCanSupportNetworkControls;
+    std::atomic<bool> mBlendSubtitlesInYUV;
     AvFramePool mFramePool;
+    int mFrameWidth;
+    int mFrameHeight;
+    enum AVPixelFormat mFramePixFormat;
     BasicYUVConverter* mCSConverter;
+    DecoderQualityController mQualityController;
 };
 
 #endif //VIDEOSTREAM_H
\ No newline at end of file
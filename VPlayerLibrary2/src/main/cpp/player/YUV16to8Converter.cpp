@@ -3,21 +3,23 @@
 
 static const char* sTag = "Colorspace16bitConverter";
 
-YUV16to8Converter::YUV16to8Converter(AVCodecContext *context, enum AVPixelFormat midFormat) :
+YUV16to8Converter::YUV16to8Converter(enum AVPixelFormat srcFormat, enum AVPixelFormat midFormat) :
         BasicYUVConverter(),
         mFrameBitDepth(0),
         mFrameBitsBigEndian(false),
 #if CONVERT_16_TO_8_ASM_ENABLED
         mConversionFn(NULL),
 #endif
-        mTmpFrame(NULL) {
+        mTmpFrame(NULL),
+        mTmpFrameWidth(0),
+        mTmpFrameHeight(0) {
     if (midFormat != AV_PIX_FMT_YUV420P && midFormat != AV_PIX_FMT_YUV422P
             && midFormat != AV_PIX_FMT_YUV444P) {
         __android_log_print(ANDROID_LOG_WARN, sTag, "Invalid mid format, will use slow conversion");
         return;
     }
 
-    const AVPixFmtDescriptor *descriptor = av_pix_fmt_desc_get(context->pix_fmt);
+    const AVPixFmtDescriptor *descriptor = av_pix_fmt_desc_get(srcFormat);
     mFrameBitDepth = descriptor->comp->depth;
     mFrameBitsBigEndian = (descriptor->flags & AV_PIX_FMT_FLAG_BE) != 0;
 
@@ -45,19 +47,13 @@ YUV16to8Converter::YUV16to8Converter(AVCodecContext *context, enum AVPixelFormat
             }
         }
 #endif
-
-        // Align the data that would be optimal for neon acceleration, 16 bytes for arm64
-        if (av_image_alloc(mTmpFrame->data, mTmpFrame->linesize, context->width,
-                           context->height, midFormat, 16) < 0) {
-            __android_log_print(ANDROID_LOG_ERROR, sTag,
-                                "Unable to allocate temporary frame for bit depth conversion");
-        }
+        // Temporary frame data is allocated on first conversion to fit the decoded frame size
     }
 }
 
 YUV16to8Converter::~YUV16to8Converter() {
     if (mTmpFrame) {
-        av_frame_unref(mTmpFrame);
+        av_freep(&mTmpFrame->data[0]);
         av_frame_free(&mTmpFrame);
         mTmpFrame = NULL;
     }
@@ -67,7 +63,7 @@ YUV16to8Converter::~YUV16to8Converter() {
 }
 
 int YUV16to8Converter::convert(AVFrame *srcFrame, AVFrame *dstFrame) {
-    if (mTmpFrame) {
+    if (mTmpFrame && ensureTmpFrameSize(srcFrame->width, srcFrame->height) >= 0) {
         mTmpFrame->width = srcFrame->width;
         mTmpFrame->height = srcFrame->height;
 
@@ -78,6 +74,26 @@ int YUV16to8Converter::convert(AVFrame *srcFrame, AVFrame *dstFrame) {
     return BasicYUVConverter::convert(srcFrame, dstFrame);
 }
 
+int YUV16to8Converter::ensureTmpFrameSize(int width, int height) {
+    if (width <= mTmpFrameWidth && height <= mTmpFrameHeight) {
+        return 0;
+    }
+
+    // Align the data that would be optimal for neon acceleration, 16 bytes for arm64
+    int ret;
+    av_freep(&mTmpFrame->data[0]);
+    mTmpFrameWidth = mTmpFrameHeight = 0;
+    if ((ret = av_image_alloc(mTmpFrame->data, mTmpFrame->linesize, width, height,
+                              (enum AVPixelFormat) mTmpFrame->format, 16)) < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag,
+                            "Unable to allocate temporary frame for bit depth conversion");
+        return ret;
+    }
+    mTmpFrameWidth = width;
+    mTmpFrameHeight = height;
+    return 0;
+}
+
 bool YUV16to8Converter::reduceYUV16to8bit(AVFrame *srcFrame, AVFrame *dstFrame) {
     const size_t width = (size_t) srcFrame->width;
     const size_t height = (size_t) srcFrame->height;
@@ -11,7 +11,7 @@ extern "C" {
 
 class YUV16to8Converter : public BasicYUVConverter {
 public:
-    YUV16to8Converter(AVCodecContext *context, enum AVPixelFormat midFormat);
+    YUV16to8Converter(enum AVPixelFormat srcFormat, enum AVPixelFormat midFormat);
     virtual ~YUV16to8Converter();
 
     virtual int convert(AVFrame *src, AVFrame *dst) override;
@@ -20,10 +20,13 @@ protected:
     virtual bool reduceYUV16to8bit(AVFrame *srcFrame, AVFrame *dstFrame);
     void reduce16BitChannelDepth(const uint16_t *src, uint8_t *dst, size_t srcStride,
                                  size_t dstStride, size_t width, size_t height);
+    int ensureTmpFrameSize(int width, int height);
 
     int mFrameBitDepth;
     bool mFrameBitsBigEndian;
     AVFrame* mTmpFrame;
+    int mTmpFrameWidth;
+    int mTmpFrameHeight;
 #if CONVERT_16_TO_8_ASM_ENABLED
     bitconv::conv16_8_func mConversionFn;
 #endif
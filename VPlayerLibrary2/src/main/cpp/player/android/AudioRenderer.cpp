@@ -3,6 +3,18 @@
 #define SEC_TO_NS 1e9
 #define STABILIZING_MAX_COUNTER 5
 
+// AudioTrack.WRITE_BLOCKING
+#define AUDIOTRACK_WRITE_BLOCKING 0
+
+// AudioFormat encodings
+#define ENCODING_PCM_16BIT 2
+#define ENCODING_PCM_FLOAT 4
+#define ENCODING_AC3 5
+#define ENCODING_E_AC3 6
+#define ENCODING_DTS 7
+#define ENCODING_DTS_HD 8
+#define ENCODING_PCM_32BIT 22
+
 static const int64_t TIMESTAMP_STABILIZING_NS = 500 * (int64_t) 1e6;    // 500 ms in nanoseconds
 static const int64_t TIMESTAMP_POLLING_NS = 20 * (int64_t) SEC_TO_NS;   // 20 secs to poll in ns
 
@@ -39,11 +51,18 @@ void AudioRenderer::initJni(JNIEnv *env) {
     sMethodAudioTrackGetSampleRate = getJavaMethod(env, clazz, sMethodAudioTrackGetSampleRateSpec);
     sMethodAudioTrackGetTimestamp = getJavaMethod(env, clazz, sMethodAudioTrackGetTimestampSpec);
     sMethodAudioTrackGetLatency = getJavaMethod(env, clazz, sMethodAudioTrackGetLatencySpec);
+    sMethodAudioTrackGetAudioFormat = getJavaMethod(env, clazz,
+                                                    sMethodAudioTrackGetAudioFormatSpec);
     sMethodAudioTrackStop = getJavaMethod(env, clazz, sMethodAudioTrackStopSpec);
     sMethodAudioTrackSetVolume = getJavaMethod(env, clazz, sMethodAudioTrackSetVolumeSpec);
     sMethodAudioTrackRelease = getJavaMethod(env, clazz, sMethodAudioTrackReleaseSpec);
     env->DeleteLocalRef(clazz);
 
+    // Buffer class
+    const jclass bufferClazz = env->FindClass(sBufferClassName);
+    sMethodBufferPosition = getJavaMethod(env, bufferClazz, sMethodBufferPositionSpec);
+    env->DeleteLocalRef(bufferClazz);
+
     // AudioTimestamp class
     const jclass tsClazz = env->FindClass(sAudioTimestampClassName);
     sMethodAudioTimeStampCtor = getJavaMethod(env, tsClazz, sMethodAudioTimestampCtorSpec);
@@ -53,13 +72,45 @@ void AudioRenderer::initJni(JNIEnv *env) {
     env->DeleteLocalRef(tsClazz);
 }
 
+int AudioRenderer::getEncoding(AVCodecContext *context, bool passthrough) {
+    if (passthrough) {
+        switch (context->codec_id) {
+            case AV_CODEC_ID_AC3:
+                return ENCODING_AC3;
+            case AV_CODEC_ID_EAC3:
+                return ENCODING_E_AC3;
+            case AV_CODEC_ID_DTS:
+                return context->profile == FF_PROFILE_DTS_HD_HRA
+                       || context->profile == FF_PROFILE_DTS_HD_MA ? ENCODING_DTS_HD : ENCODING_DTS;
+            default:
+                break;
+        }
+    }
+
+    // Keep the precision the decoder outputs when the sink supports it
+    switch (av_get_packed_sample_fmt(context->sample_fmt)) {
+        case AV_SAMPLE_FMT_FLT:
+        case AV_SAMPLE_FMT_DBL:
+            return ENCODING_PCM_FLOAT;
+        case AV_SAMPLE_FMT_S32:
+            return ENCODING_PCM_32BIT;
+        default:
+            return ENCODING_PCM_16BIT;
+    }
+}
+
 AudioRenderer::AudioRenderer(JniCallbackHandler *handler, jobject jAudioTrack, JNIEnv* env) :
+        instance(jAudioTrack),
         mJniHandler(handler),
         mChannels(0),
         mSampleRate(0),
-        mLayout(0),
         mFormat(AV_SAMPLE_FMT_NONE),
-        instance(jAudioTrack),
+        mLayout(0),
+        mPassthrough(false),
+        mReleased(false),
+        mBuffer(NULL),
+        mBufferCapacity(0),
+        mJBuffer(NULL),
         mFramesWritten(0),
         mUseTimestampApi(true),
         mLastFramePosition(0),
@@ -74,8 +125,26 @@ AudioRenderer::AudioRenderer(JniCallbackHandler *handler, jobject jAudioTrack, J
     mChannels = env->CallIntMethod(instance, sMethodAudioTrackChannelCount);
     if (0 < mChannels && mChannels < 9) {
         mSampleRate = env->CallIntMethod(instance, sMethodAudioTrackGetSampleRate);
-        mFormat = AV_SAMPLE_FMT_S16;
         mLayout = sAndroidChannelLayout[mChannels - 1];
+
+        // The track may have fallen back from the encoding asked for
+        switch (env->CallIntMethod(instance, sMethodAudioTrackGetAudioFormat)) {
+            case ENCODING_PCM_FLOAT:
+                mFormat = AV_SAMPLE_FMT_FLT;
+                break;
+            case ENCODING_PCM_32BIT:
+                mFormat = AV_SAMPLE_FMT_S32;
+                break;
+            case ENCODING_AC3:
+            case ENCODING_E_AC3:
+            case ENCODING_DTS:
+            case ENCODING_DTS_HD:
+                mPassthrough = true;
+                break;
+            default:
+                mFormat = AV_SAMPLE_FMT_S16;
+                break;
+        }
     } else {
         __android_log_print(ANDROID_LOG_ERROR, sTag,
                             "Cannot create swr because channel size is invalid: %d", mChannels);
@@ -84,30 +153,61 @@ AudioRenderer::AudioRenderer(JniCallbackHandler *handler, jobject jAudioTrack, J
 }
 
 AudioRenderer::~AudioRenderer() {
+    if (mBuffer) {
+        JNIEnv* env = mJniHandler->getEnv();
+        if (env) {
+            releaseBuffer(env);
+        } else {
+            __android_log_print(ANDROID_LOG_ERROR, sTag,
+                                "Audio buffer cannot be released because no jni env, will leak!");
+        }
+    }
     if (mOldHeadTimeSmoothArr) {
         delete[] mOldHeadTimeSmoothArr;
     }
 }
 
-int AudioRenderer::write(uint8_t *data, int len) {
+uint8_t *AudioRenderer::getBuffer(int size) {
     std::lock_guard<std::mutex> lk(mMutex);
+    if (mReleased) {
+        return NULL;
+    }
+    if ((size_t) size <= mBufferCapacity) {
+        return mBuffer;
+    }
     JNIEnv* env = mJniHandler->getEnv();
-    if (!env) {
+    if (!env || !ensureBuffer(env, (size_t) size)) {
+        return NULL;
+    }
+    return mBuffer;
+}
+
+int AudioRenderer::write(uint8_t *data, int len, int numSamples) {
+    std::lock_guard<std::mutex> lk(mMutex);
+    JNIEnv* env = mJniHandler->getEnv();
+    if (!env || mReleased) {
         return -1;
     }
-    jbyteArray jArr = env->NewByteArray(len);
-    if (jArr == NULL) {
-        return AVERROR(ENOMEM);
+
+    // Audio not decoded into the shared buffer is copied there first
+    if (data < mBuffer || data + len > mBuffer + mBufferCapacity) {
+        if (!ensureBuffer(env, (size_t) len)) {
+            return AVERROR(ENOMEM);
+        }
+        memcpy(mBuffer, data, (size_t) len);
+        data = mBuffer;
     }
-    jbyte *jSamples = env->GetByteArrayElements(jArr, NULL);
-    if (jSamples == NULL) {
-        return AVERROR(ENOMEM);
+
+    // AudioTrack reads from the position of the buffer, partial writes continue from the middle
+    jobject buffer = env->CallObjectMethod(mJBuffer, sMethodBufferPosition, (jint) (data - mBuffer));
+    env->DeleteLocalRef(buffer);
+    int ret = env->CallIntMethod(instance, sMethodAudioTrackWrite, mJBuffer, len,
+                                 AUDIOTRACK_WRITE_BLOCKING);
+    if (ret > 0) {
+        // Compressed audio has no fixed size per sample
+        mFramesWritten += mPassthrough ? (long) ((int64_t) numSamples * ret / len)
+                                       : ret / (numChannels() * av_get_bytes_per_sample(format()));
     }
-    memcpy(jSamples, data, (size_t) len);
-    env->ReleaseByteArrayElements(jArr, jSamples, 0);
-    int ret = env->CallIntMethod(instance, sMethodAudioTrackWrite, jArr, 0, len);
-    env->DeleteLocalRef(jArr);
-    mFramesWritten += ret / (numChannels() * av_get_bytes_per_sample(format()));
     return ret;
 }
 
@@ -163,9 +263,59 @@ int AudioRenderer::setVolume(float gain) {
 int AudioRenderer::release(JNIEnv* env) {
     std::lock_guard<std::mutex> lk(mMutex);
     env->CallVoidMethod(instance, sMethodAudioTrackRelease);
+
+    // Audio may still be decoding into the buffer without the lock, only free it when destroyed
+    mReleased = true;
+    if (mJBuffer) {
+        env->DeleteGlobalRef(mJBuffer);
+        mJBuffer = NULL;
+    }
     return 0;
 }
 
+bool AudioRenderer::ensureBuffer(JNIEnv *env, size_t size) {
+    if (size <= mBufferCapacity) {
+        return true;
+    }
+
+    // Leave room so frames slightly larger from sync compensation do not create a new buffer
+    const size_t capacity = size + size / 4;
+    uint8_t* data = (uint8_t*) av_malloc(capacity);
+    if (!data) {
+        return false;
+    }
+    jobject buffer = env->NewDirectByteBuffer(data, (jlong) capacity);
+    jobject gBuffer = NULL;
+    if (buffer) {
+        gBuffer = env->NewGlobalRef(buffer);
+        env->DeleteLocalRef(buffer);
+    }
+    if (!gBuffer) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag, "Cannot create direct buffer for audio");
+        av_free(data);
+        return false;
+    }
+
+    // Audio already decoded into the buffer is kept
+    if (mBuffer) {
+        memcpy(data, mBuffer, mBufferCapacity);
+    }
+    releaseBuffer(env);
+    mBuffer = data;
+    mJBuffer = gBuffer;
+    mBufferCapacity = capacity;
+    return true;
+}
+
+void AudioRenderer::releaseBuffer(JNIEnv *env) {
+    if (mJBuffer) {
+        env->DeleteGlobalRef(mJBuffer);
+        mJBuffer = NULL;
+    }
+    av_freep(&mBuffer);
+    mBufferCapacity = 0;
+}
+
 double AudioRenderer::getLatency() {
     return mLastLatencySec;
 }
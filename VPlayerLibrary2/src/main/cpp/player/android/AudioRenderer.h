@@ -7,7 +7,7 @@
 
 // AudioTrack
 static const char* sAudioTrackClassName = "android/media/AudioTrack";
-static JavaMethod sMethodAudioTrackWriteSpec = {"write", "([BII)I"};
+static JavaMethod sMethodAudioTrackWriteSpec = {"write", "(Ljava/nio/ByteBuffer;II)I"};
 static JavaMethod sMethodAudioTrackPauseSpec = {"pause", "()V"};
 static JavaMethod sMethodAudioTrackPlaySpec = {"play", "()V"};
 static JavaMethod sMethodAudioTrackFlushSpec = {"flush", "()V"};
@@ -17,6 +17,7 @@ static JavaMethod sMethodAudioTrackReleaseSpec = {"release", "()V"};
 static JavaMethod sMethodAudioTrackChannelCountSpec = {"getChannelCount", "()I"};
 static JavaMethod sMethodAudioTrackGetSampleRateSpec = {"getSampleRate", "()I"};
 static JavaMethod sMethodAudioTrackGetLatencySpec = {"getLatency", "()I"};
+static JavaMethod sMethodAudioTrackGetAudioFormatSpec = {"getAudioFormat", "()I"};
 static JavaMethod sMethodAudioTrackGetTimestampSpec = {"getTimestamp",
                                                        "(Landroid/media/AudioTimestamp;)Z"};
 static jmethodID sMethodAudioTrackWrite;
@@ -26,11 +27,17 @@ static jmethodID sMethodAudioTrackFlush;
 static jmethodID sMethodAudioTrackChannelCount;
 static jmethodID sMethodAudioTrackGetSampleRate;
 static jmethodID sMethodAudioTrackGetLatency;
+static jmethodID sMethodAudioTrackGetAudioFormat;
 static jmethodID sMethodAudioTrackGetTimestamp;
 static jmethodID sMethodAudioTrackStop;
 static jmethodID sMethodAudioTrackSetVolume;
 static jmethodID sMethodAudioTrackRelease;
 
+// Buffer
+static const char* sBufferClassName = "java/nio/Buffer";
+static JavaMethod sMethodBufferPositionSpec = {"position", "(I)Ljava/nio/Buffer;"};
+static jmethodID sMethodBufferPosition;
+
 // AudioTimestamp
 static const char* sAudioTimestampClassName = "android/media/AudioTimestamp";
 static JavaMethod sMethodAudioTimestampCtorSpec = {"<init>", "()V"};
@@ -46,16 +53,27 @@ class AudioRenderer : public IAudioRenderer {
 public:
     static void initJni(JNIEnv *env);
 
+    /**
+     * AudioFormat encoding to ask for when creating the AudioTrack, it can fall back to another one
+     * @param passthrough prefer the compressed stream for AC3, EAC3 and DTS
+     */
+    static int getEncoding(AVCodecContext* context, bool passthrough);
+
     AudioRenderer(JniCallbackHandler* handler, jobject jAudioTrack, JNIEnv* env);
     ~AudioRenderer();
 
-    int write(uint8_t *data, int len) override;
+    uint8_t* getBuffer(int size) override;
+    int write(uint8_t *data, int len, int numSamples) override;
     int pause() override;
     int play() override;
     int flush() override;
     int stop() override;
     int setVolume(float gain) override;
 
+    /**
+     * Release the AudioTrack, writing fails afterwards. Memory from getBuffer() stays valid until
+     * the renderer is deleted, which must wait until nothing decodes audio anymore
+     */
     int release(JNIEnv* env);
 
     int numChannels() override {
@@ -74,11 +92,17 @@ public:
         return mFormat;
     }
 
+    bool isPassthrough() override {
+        return mPassthrough;
+    }
+
     double getLatency() override;
     double updateLatency(bool force = false) override;
 
     jobject instance;
 private:
+    bool ensureBuffer(JNIEnv* env, size_t size);
+    void releaseBuffer(JNIEnv* env);
     bool getTimeStamp(long* outFramePosition, long* outNanoTime);
     double getLatencyOldMethod();
 
@@ -90,6 +114,13 @@ private:
     jint mSampleRate;
     enum AVSampleFormat mFormat;
     int64_t mLayout;
+    bool mPassthrough;
+    bool mReleased;
+
+    // Native memory shared with AudioTrack through a direct ByteBuffer
+    uint8_t* mBuffer;
+    size_t mBufferCapacity;
+    jobject mJBuffer;
 
     // Calculate latency
     long mFramesWritten;
@@ -0,0 +1,61 @@
+#include "DirectBufferPool.h"
+#include <android/log.h>
+
+static const char* sTag = "DirectBufferPool";
+
+DirectBufferPool::DirectBufferPool() {
+}
+
+DirectBufferPool::~DirectBufferPool() {
+    if (!mEntries.empty()) {
+        __android_log_print(ANDROID_LOG_WARN, sTag, "Pool destroyed without releasing %d buffers",
+                            (int) mEntries.size());
+    }
+}
+
+void DirectBufferPool::beginFrame() {
+    for (Entry& entry : mEntries) {
+        entry.used = false;
+    }
+}
+
+jobject DirectBufferPool::obtain(JNIEnv *env, void *data, size_t size) {
+    if (data == NULL || size == 0) {
+        return NULL;
+    }
+    for (Entry& entry : mEntries) {
+        if (entry.data == data && entry.size == size) {
+            entry.used = true;
+            return entry.buffer;
+        }
+    }
+
+    jobject localBuffer = env->NewDirectByteBuffer(data, (jlong) size);
+    if (localBuffer == NULL) {
+        __android_log_print(ANDROID_LOG_ERROR, sTag, "Unable to create direct buffer");
+        return NULL;
+    }
+    jobject buffer = env->NewGlobalRef(localBuffer);
+    env->DeleteLocalRef(localBuffer);
+    mEntries.push_back({data, size, buffer, true});
+    return buffer;
+}
+
+void DirectBufferPool::endFrame(JNIEnv *env) {
+    size_t n = 0;
+    for (size_t i = 0; i < mEntries.size(); ++i) {
+        if (mEntries[i].used) {
+            mEntries[n++] = mEntries[i];
+        } else {
+            env->DeleteGlobalRef(mEntries[i].buffer);
+        }
+    }
+    mEntries.resize(n);
+}
+
+void DirectBufferPool::release(JNIEnv *env) {
+    for (Entry& entry : mEntries) {
+        env->DeleteGlobalRef(entry.buffer);
+    }
+    mEntries.clear();
+}
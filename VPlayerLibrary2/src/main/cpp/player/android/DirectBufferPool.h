@@ -0,0 +1,41 @@
+#ifndef VPLAYER_LIB2_DIRECTBUFFERPOOL_H
+#define VPLAYER_LIB2_DIRECTBUFFERPOOL_H
+
+#include <cstddef>
+#include <vector>
+#include <jni.h>
+
+/**
+ * Keeps direct ByteBuffers wrapping native memory alive across calls so the same Java buffer is
+ * handed out again while the native memory stays the same. Buffers not used within a frame are
+ * released at the end of it since their native memory may be freed or reused.
+ */
+class DirectBufferPool {
+public:
+    DirectBufferPool();
+    ~DirectBufferPool();
+
+    void beginFrame();
+
+    /**
+     * Get a direct ByteBuffer for the memory, reused if the last frame asked for the same one
+     * @return a global reference owned by the pool or NULL if it cannot be created
+     */
+    jobject obtain(JNIEnv* env, void* data, size_t size);
+
+    void endFrame(JNIEnv* env);
+
+    void release(JNIEnv* env);
+
+private:
+    struct Entry {
+        void* data;
+        size_t size;
+        jobject buffer;
+        bool used;
+    };
+
+    std::vector<Entry> mEntries;
+};
+
+#endif //VPLAYER_LIB2_DIRECTBUFFERPOOL_H
@@ -55,6 +55,7 @@ void JniCallbackHandler::deleteInstanceGlobalRef(JNIEnv *env) {
     JniHelper::deleteInstanceGlobalRef(env);
     std::lock_guard<std::mutex> lk(mMutex);
     if (mAudioRenderer) {
+        // Player was deleted before this, so its audio thread no longer uses the renderer
         if (env) {
             mAudioRenderer->release(env);
             env->DeleteGlobalRef(mAudioRenderer->instance);
@@ -166,11 +167,13 @@ void JniCallbackHandler::onPlaybackChanged(bool playing) {
     env->CallVoidMethod(mInstance, sMethodPlaybackChanged, playing);
 }
 
-IAudioRenderer *JniCallbackHandler::createAudioRenderer(AVCodecContext *context) {
+IAudioRenderer *JniCallbackHandler::createAudioRenderer(AVCodecContext *context,
+                                                       bool passthrough) {
     JNIEnv* env = getEnv();
     std::lock_guard<std::mutex> lk(mMutex);
     jobject audioTrack = env->CallObjectMethod(mInstance, sMethodCreateAudioTrack,
-                                               context->sample_rate, context->channels);
+                                               context->sample_rate, context->channels,
+                                               AudioRenderer::getEncoding(context, passthrough));
     if (audioTrack == NULL) {
         __android_log_print(ANDROID_LOG_ERROR, sTag,
                             "Cannot create audio track because java failed to return it");
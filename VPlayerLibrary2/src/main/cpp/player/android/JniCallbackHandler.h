@@ -21,7 +21,7 @@ static jmethodID sMethodHashMapDefaultConstructor;
 static const JavaMethod sMethodDefaultConstSpec = {"<init>", "()V"};
 static const JavaMethod sMethodNativeErrorSpec = {"nativeStreamError", "(ILjava/lang/String;)V"};
 static const JavaMethod sMethodMetadataReadySpec = {"nativeMetadataReady", "([Ljava/util/Map;)V"};
-static const JavaMethod sMethodCreateAudioTrackSpec = {"nativeCreateAudioTrack", "(II)Landroid/media/AudioTrack;"};
+static const JavaMethod sMethodCreateAudioTrackSpec = {"nativeCreateAudioTrack", "(III)Landroid/media/AudioTrack;"};
 static const JavaMethod sMethodStreamReadySpec = {"nativeStreamReady", "()V"};
 static const JavaMethod sMethodStreamFinishedSpec = {"nativeStreamFinished", "()V"};
 static const JavaMethod sMethodProgressChangedSpec = {"nativeProgressChanged", "(JJ)V"};
@@ -53,7 +53,7 @@ public:
     void onProgressChanged(long currentMs, long durationMs);
     void onPlaybackChanged(bool playing) override;
 
-    IAudioRenderer *createAudioRenderer(AVCodecContext *context) override;
+    IAudioRenderer *createAudioRenderer(AVCodecContext *context, bool passthrough) override;
 
     bool onThreadStart() override;
     void onThreadEnd() override;
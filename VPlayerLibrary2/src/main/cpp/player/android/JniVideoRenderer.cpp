@@ -14,7 +14,8 @@ JniVideoRenderer::JniVideoRenderer() :
         mWindow(NULL),
         mSubWindow(NULL),
         mWindowWritten(false),
-        mSubWindowWritten(false) {
+        mSubWindowWritten(false),
+        mSubWindowValid(false) {
     mWindowBuffer.width = mWindowBuffer.height = 0;
     mSubWindowBuffer.width = mSubWindowBuffer.height = 0;
 }
@@ -50,6 +51,7 @@ void JniVideoRenderer::release() {
         mSubWindow = NULL;
     }
     mSubWindowWritten = false;
+    mSubWindowValid = false;
     mWindowWritten = false;
 }
 
@@ -57,7 +59,8 @@ bool JniVideoRenderer::writeSubtitlesSeparately() {
     return mSubWindow != NULL;
 }
 
-int JniVideoRenderer::writeFrame(AVFrame* videoFrame, AVFrame* subtitleFrame) {
+int JniVideoRenderer::writeFrame(AVFrame* videoFrame, AVFrame* subtitleFrame,
+                                 const SubtitleFrameQueue::Rect* subtitleDamage) {
     std::lock_guard<std::mutex> lk(mMutex);
     if (!mWindow) return 0;
     int ret = writeFrameToWindow(videoFrame, mWindow, mWindowBuffer, !mWindowWritten);
@@ -68,10 +71,23 @@ int JniVideoRenderer::writeFrame(AVFrame* videoFrame, AVFrame* subtitleFrame) {
     mWindowWritten = true;
 
     if (mSubWindow && subtitleFrame) {
-        if ((ret = writeFrameToWindow(subtitleFrame, mSubWindow, mSubWindowBuffer,
-                !mSubWindowWritten)) < 0) {
+        const bool writeDamage = subtitleDamage != NULL && mSubWindowValid && !mSubWindowWritten
+                                 && subtitleFrame->width == mSubWindowBuffer.width
+                                 && subtitleFrame->height == mSubWindowBuffer.height;
+        if (writeDamage && subtitleDamage->isEmpty()) {
+            // Nothing changed, the window keeps showing the last subtitles
+            return ret;
+        }
+        if (writeDamage) {
+            ret = writeSubtitleDamageToWindow(subtitleFrame, *subtitleDamage);
+        } else {
+            ret = writeFrameToWindow(subtitleFrame, mSubWindow, mSubWindowBuffer,
+                                     !mSubWindowWritten);
+        }
+        if (ret < 0) {
             __android_log_print(ANDROID_LOG_ERROR, sTag, "Unable to write sub frame for render");
         }
+        mSubWindowValid = ret >= 0;
         mSubWindowWritten = true;
     }
     return ret;
@@ -120,14 +136,40 @@ int JniVideoRenderer::writeFrameToWindow(AVFrame *frame, ANativeWindow *window,
     return 0;
 }
 
+int JniVideoRenderer::writeSubtitleDamageToWindow(AVFrame *frame,
+                                                  const SubtitleFrameQueue::Rect &damage) {
+    ARect bounds = {damage.x, damage.y, damage.x + damage.width, damage.y + damage.height};
+    int ret = lockBufferToWindow(mSubWindow, mSubWindowBuffer, frame->width, frame->height,
+                                 &bounds);
+    if (ret < 0) {
+        return ret;
+    }
+
+    // Window grows the bounds when it could not keep the content of the last buffer
+    bounds.left = std::max(bounds.left, 0);
+    bounds.top = std::max(bounds.top, 0);
+    bounds.right = std::min(bounds.right, frame->width);
+    bounds.bottom = std::min(bounds.bottom, frame->height);
+    if (bounds.right <= bounds.left || bounds.bottom <= bounds.top) {
+        return 0;
+    }
+    const int bufferLineSize = mSubWindowBuffer.stride * 4;
+    av_image_copy_plane((uint8_t*) mSubWindowBuffer.bits + bounds.top * bufferLineSize
+                        + bounds.left * 4, bufferLineSize,
+                        frame->data[0] + bounds.top * frame->linesize[0] + bounds.left * 4,
+                        frame->linesize[0], (bounds.right - bounds.left) * 4,
+                        bounds.bottom - bounds.top);
+    return 0;
+}
+
 int JniVideoRenderer::lockBufferToWindow(ANativeWindow *window, ANativeWindow_Buffer &buffer,
-                                         int width, int height) {
+                                         int width, int height, ARect* inOutDirtyBounds) {
     if (!window) {
         return 0;
     }
     int ret;
     ANativeWindow_setBuffersGeometry(window, width, height, WINDOW_FORMAT_RGBA_8888);
-    if ((ret = ANativeWindow_lock(window, &buffer, NULL)) < 0) {
+    if ((ret = ANativeWindow_lock(window, &buffer, inOutDirtyBounds)) < 0) {
         return ret;
     }
 
@@ -18,7 +18,8 @@ public:
     void onSurfaceCreated(JNIEnv* env, jobject vSurface, jobject sSurface);
     void onSurfaceDestroyed();
 
-    int writeFrame(AVFrame* videoFrame, AVFrame* subtitleFrame) override;
+    int writeFrame(AVFrame* videoFrame, AVFrame* subtitleFrame,
+                   const SubtitleFrameQueue::Rect* subtitleDamage) override;
     int renderFrame() override;
 
     bool writeSubtitlesSeparately() override;
@@ -27,7 +28,9 @@ public:
 
 private:
     int writeFrameToWindow(AVFrame* f, ANativeWindow* win, ANativeWindow_Buffer& buf, bool lock);
-    int lockBufferToWindow(ANativeWindow *window, ANativeWindow_Buffer &buffer, int w, int h);
+    int writeSubtitleDamageToWindow(AVFrame* frame, const SubtitleFrameQueue::Rect& damage);
+    int lockBufferToWindow(ANativeWindow *window, ANativeWindow_Buffer &buffer, int w, int h,
+                           ARect* inOutDirtyBounds = NULL);
     int internalRenderFrame();
     void release();
 
@@ -40,6 +43,9 @@ private:
 
     bool mWindowWritten;
     bool mSubWindowWritten;
+
+    // The subtitle window holds the last subtitle frame, only changes need to be written
+    bool mSubWindowValid;
 };
 
 #endif //JNIVIDEORENDERER_H
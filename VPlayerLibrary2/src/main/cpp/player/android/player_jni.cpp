@@ -121,6 +121,46 @@ JNIEXPORT void EXPORT_PLAYER(nativeSetDefaultSubtitleFont) (JNIEnv *env, jobject
     }
 }
 
+JNIEXPORT void EXPORT_PLAYER(nativeSetBlendSubtitlesInYUV) (JNIEnv *env, jobject instance,
+                                                            jboolean flag) {
+    Player* player = getPtr<Player>(env, instance, sNativePlayerInstance);
+    if (player) {
+        player->setBlendSubtitlesInYUV(flag);
+    }
+}
+
+JNIEXPORT void EXPORT_PLAYER(nativeSetSubtitleCacheBudget) (JNIEnv *env, jobject instance,
+                                                            jint megabytes) {
+    Player* player = getPtr<Player>(env, instance, sNativePlayerInstance);
+    if (player) {
+        player->setSubtitleCacheBudget(megabytes);
+    }
+}
+
+JNIEXPORT void JNICALL EXPORT_PLAYER(nativeSetPlaybackSpeed) (JNIEnv *env, jobject instance,
+                                                             jfloat speed) {
+    Player* player = getPtr<Player>(env, instance, sNativePlayerInstance);
+    if (player) {
+        player->setPlaybackSpeed(speed);
+    }
+}
+
+JNIEXPORT void JNICALL EXPORT_PLAYER(nativeSetAudioResampleQuality) (JNIEnv *env, jobject instance,
+                                                                    jint quality) {
+    Player* player = getPtr<Player>(env, instance, sNativePlayerInstance);
+    if (player) {
+        player->setAudioResampleQuality(quality);
+    }
+}
+
+JNIEXPORT void JNICALL EXPORT_PLAYER(nativeSetAudioPassthrough) (JNIEnv *env, jobject instance,
+                                                                jboolean flag) {
+    Player* player = getPtr<Player>(env, instance, sNativePlayerInstance);
+    if (player) {
+        player->setAudioPassthrough(flag);
+    }
+}
+
 JNIEXPORT void JNICALL EXPORT_PLAYER(nativeRenderLastFrame) (JNIEnv *env, jobject instance) {
     JniVideoRenderer* vRenderer = getPtr<JniVideoRenderer>(env, instance, sNativeJniVideoRenderer);
     Player* player = getPtr<Player>(env, instance, sNativePlayerInstance);
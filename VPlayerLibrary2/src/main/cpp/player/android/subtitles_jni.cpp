@@ -1,5 +1,6 @@
 #include "../ASSRenderer.h"
 #include "JniHelper.h"
+#include "DirectBufferPool.h"
 
 #define EXPORT_RENDERER(name) JAVA_EXPORT_NAME1(name,com_matthewn4444_vplayerlibrary2_ASSRenderer)
 #define EXPORT_TRACK(name) JAVA_EXPORT_NAME1(name,com_matthewn4444_vplayerlibrary2_ASSTrack)
@@ -9,11 +10,15 @@ static const char* sTag = "NativeJNISubtitles";
 // Renderer Class
 static const JavaField sNativeRendererSpec = {"mRendererInstance", "J"};
 static jfieldID sNativeRendererInstance;
+static const JavaField sNativeBufferPoolSpec = {"mBufferPoolInstance", "J"};
+static jfieldID sNativeBufferPoolInstance;
 
 // ASSBitmap Class
 static JavaMethod sMethodASSBitmapCtorSpec = {"<init>", "(IIII[BZI)V"};
+static JavaMethod sMethodASSBitmapDirectCtorSpec = {"<init>", "(IIIILjava/nio/ByteBuffer;ZI)V"};
 static jclass gClassASSBitmap = NULL;
 static jmethodID sMethodASSBitmapCtor;
+static jmethodID sMethodASSBitmapDirectCtor;
 
 // ASSFrame Class
 static JavaMethod sMethodASSFrameCtorSpec = {"<init>", "(J[L" JAVA_PKG_PATH "/ASSBitmap;)V"};
@@ -25,11 +30,13 @@ JNIEXPORT void EXPORT_RENDERER(nativeInit) (JNIEnv *env, jclass type) {
     // Renderer Class
     const jclass clazz = env->FindClass(JAVA_PKG_PATH"/ASSRenderer");
     sNativeRendererInstance = getJavaField(env, clazz, sNativeRendererSpec);
+    sNativeBufferPoolInstance = getJavaField(env, clazz, sNativeBufferPoolSpec);
     env->DeleteLocalRef(clazz);
 
     // ASSBitmap class
     const jclass imgClazz = env->FindClass(JAVA_PKG_PATH"/ASSBitmap");
     sMethodASSBitmapCtor = getJavaMethod(env, imgClazz, sMethodASSBitmapCtorSpec);
+    sMethodASSBitmapDirectCtor = getJavaMethod(env, imgClazz, sMethodASSBitmapDirectCtorSpec);
     env->DeleteLocalRef(imgClazz);
 
     // ASSFrame class
@@ -86,12 +93,38 @@ JNIEXPORT void JNICALL EXPORT_RENDERER(addFont) (JNIEnv *env, jobject instance,
     }
 }
 
+JNIEXPORT void JNICALL EXPORT_RENDERER(setCacheBudget) (JNIEnv *env, jobject instance,
+                                                        jint megabytes) {
+    auto* renderer = getPtr<ASSRenderer>(env, instance, sNativeRendererInstance);
+    if (renderer) {
+        renderer->setCacheBudget(megabytes);
+    }
+}
+
+JNIEXPORT void JNICALL EXPORT_RENDERER(nativeSetDirectBuffers) (JNIEnv *env, jobject instance,
+                                                                jboolean enabled) {
+    auto* pool = getPtr<DirectBufferPool>(env, instance, sNativeBufferPoolInstance);
+    if (enabled && !pool) {
+        setPtr(env, instance, sNativeBufferPoolInstance, new DirectBufferPool());
+    } else if (!enabled && pool) {
+        pool->release(env);
+        delete pool;
+        setPtr(env, instance, sNativeBufferPoolInstance, NULL);
+    }
+}
+
 JNIEXPORT void JNICALL EXPORT_RENDERER(nativeRelease) (JNIEnv *env, jobject instance) {
     auto* renderer = getPtr<ASSRenderer>(env, instance, sNativeRendererInstance);
     if (renderer) {
         delete renderer;
         setPtr(env, instance, sNativeRendererInstance, NULL);
     }
+    auto* pool = getPtr<DirectBufferPool>(env, instance, sNativeBufferPoolInstance);
+    if (pool) {
+        pool->release(env);
+        delete pool;
+        setPtr(env, instance, sNativeBufferPoolInstance, NULL);
+    }
 
     // Delete global references to the classes
     if (gClassASSBitmap) {
@@ -156,8 +189,27 @@ JNIEXPORT jobject JNICALL EXPORT_RENDERER(nativeGetImage) (JNIEnv *env, jobject
 
         jobjectArray jBitmaps = env->NewObjectArray(size, gClassASSBitmap, nullptr);
         jobject jFrame = env->NewObject(gClassASSFrame, sMethodASSFrameCtor, timeMs, jBitmaps);
+        auto* pool = getPtr<DirectBufferPool>(env, instance, sNativeBufferPoolInstance);
+        if (pool) {
+            // Hand out direct buffers to the native bitmap memory instead of copying pixels,
+            // they are valid until the next frame is requested
+            pool->beginFrame();
+            for (int i = 0; i < size; ++i) {
+                ASSBitmap* b = bitmaps[i];
+                jobject buffer = pool->obtain(env, b->buffer, b->size);
+                jobject jBitmap = env->NewObject(gClassASSBitmap, sMethodASSBitmapDirectCtor,
+                        b->x1, b->y1, b->x2, b->y2, buffer, b->changed, b->stride);
+                env->SetObjectArrayElement(jBitmaps, i, jBitmap);
+                env->DeleteLocalRef(jBitmap);
+            }
+            pool->endFrame(env);
+            return jFrame;
+        }
         for (int i = 0; i < size; ++i) {
             ASSBitmap* b = bitmaps[i];
+
+            // Java cannot match bitmaps to the last frame's, so every bitmap carries its pixels
+            // and changed is only a hint
             jbyteArray data = b->size > 0 ? env->NewByteArray((int) b->size) : nullptr;
             if (data != nullptr) {
                 env->SetByteArrayRegion(data, 0, (int) b->size, (const jbyte *) b->buffer);
@@ -165,6 +217,10 @@ JNIEXPORT jobject JNICALL EXPORT_RENDERER(nativeGetImage) (JNIEnv *env, jobject
             jobject jBitmap = env->NewObject(gClassASSBitmap, sMethodASSBitmapCtor, b->x1,
                     b->y1, b->x2, b->y2, data, b->changed, b->stride);
             env->SetObjectArrayElement(jBitmaps, i, jBitmap);
+            env->DeleteLocalRef(jBitmap);
+            if (data != nullptr) {
+                env->DeleteLocalRef(data);
+            }
         }
         return jFrame;
     }
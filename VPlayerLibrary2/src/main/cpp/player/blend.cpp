@@ -0,0 +1,679 @@
+#include "blend.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+#define BLEND_NEON 1
+#include <arm_neon.h>
+#elif defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define BLEND_SSE2 1
+#include <immintrin.h>
+#if defined(__clang__) || defined(__GNUC__)
+#define BLEND_AVX2 1
+#endif
+#endif
+
+#define ALPHA_SHIFT 24
+
+// Chroma samples of a row blended per pass, their sums are kept on the stack
+#define CHROMA_CHUNK 128
+
+namespace alphablend {
+
+    // x / 255 rounded for x <= 255 * 255, same as the SIMD kernels
+    static inline uint32_t div255(uint32_t x) {
+        x += 128;
+        return (x + (x >> 8)) >> 8;
+    }
+
+    static inline uint8_t addSaturate(uint32_t a, uint32_t b) {
+        return (uint8_t) (a + b > 0xff ? 0xff : a + b);
+    }
+
+    void premultiply(uint8_t *data, size_t stride, size_t width, size_t height) {
+        for (size_t y = 0; y < height; y++) {
+            uint8_t *p = data + y * stride;
+            for (size_t x = 0; x < width; x++, p += 4) {
+                const uint32_t a = p[3];
+                if (a != 0xff) {
+                    p[0] = (uint8_t) div255(p[0] * a);
+                    p[1] = (uint8_t) div255(p[1] * a);
+                    p[2] = (uint8_t) div255(p[2] * a);
+                }
+            }
+        }
+    }
+
+    void blendRowC(uint8_t *dst, const uint8_t *src, size_t width) {
+        for (size_t x = 0; x < width; x++, dst += 4, src += 4) {
+            const uint32_t a = src[3];
+            if (a == 0) {
+                continue;
+            }
+            const uint32_t ia = 0xff - a;
+            dst[0] = addSaturate(src[0], div255(dst[0] * ia));
+            dst[1] = addSaturate(src[1], div255(dst[1] * ia));
+            dst[2] = addSaturate(src[2], div255(dst[2] * ia));
+            dst[3] = addSaturate(src[3], div255(dst[3] * ia));
+        }
+    }
+
+    void blendMaskRowC(uint8_t *dst, const uint8_t *mask, size_t width, uint8_t value,
+                       uint8_t opacity) {
+        for (size_t x = 0; x < width; x++) {
+            const uint32_t a = div255((uint32_t) mask[x] * opacity);
+            if (a != 0) {
+                dst[x] = (uint8_t) div255(value * a + dst[x] * (0xff - a));
+            }
+        }
+    }
+
+    static inline uint8_t clip8(int v) {
+        return (uint8_t) (v < 0 ? 0 : (v > 0xff ? 0xff : v));
+    }
+
+    // BT.601 rows for y, u and v as {r, g, b, offset}, the offset is scaled by the alpha so
+    // premultiplied colours stay premultiplied
+    static const int sLimitedCoefficients[3][4] = {
+            {66, 129, 25, 16},
+            {-38, -74, 112, 128},
+            {112, -94, -18, 128},
+    };
+    static const int sFullCoefficients[3][4] = {
+            {77, 150, 29, 0},
+            {-43, -85, 128, 128},
+            {128, -107, -21, 128},
+    };
+
+    static inline int convertComponent(const int *c, int r, int g, int b, int a) {
+        return ((c[0] * r + c[1] * g + c[2] * b + 128) >> 8) + (int) div255(c[3] * a);
+    }
+
+    // One plane of premultiplied RGBA pixels blended into a row of that plane
+    static void blendPremultipliedRowToPlaneC(uint8_t *dst, const uint8_t *src, size_t width,
+                                              const int *c) {
+        for (size_t x = 0; x < width; x++, src += 4) {
+            const uint32_t a = src[3];
+            if (a != 0) {
+                dst[x] = clip8(convertComponent(c, src[0], src[1], src[2], a)
+                               + (int) div255(dst[x] * (0xff - a)));
+            }
+        }
+    }
+
+    // Adds the scaled coverage of each block of 1 << shiftX mask samples to its sum
+    static void addCoverageRowC(uint16_t *sums, const uint8_t *mask, size_t count,
+                                uint8_t opacity, int shiftX) {
+        for (size_t i = 0; i < count; i++) {
+            for (int k = 0; k < 1 << shiftX; k++) {
+                sums[i] += div255((uint32_t) *mask++ * opacity);
+            }
+        }
+    }
+
+    // Adds each channel of each block of 1 << shiftX pixels to the 4 sums of that block
+    static void addPixelRowC(uint16_t *sums, const uint8_t *src, size_t count, int shiftX) {
+        for (size_t i = 0; i < count; i++, sums += 4) {
+            for (int k = 0; k < 1 << shiftX; k++, src += 4) {
+                sums[0] += src[0];
+                sums[1] += src[1];
+                sums[2] += src[2];
+                sums[3] += src[3];
+            }
+        }
+    }
+
+#if defined(BLEND_NEON)
+
+    static inline uint8x8_t div255Neon(uint16x8_t x) {
+        return vraddhn_u16(x, vrshrq_n_u16(x, 8));
+    }
+
+    // 8 samples per iteration
+    static void blendMaskRowNeon(uint8_t *dst, const uint8_t *mask, size_t width, uint8_t value,
+                                 uint8_t opacity) {
+        const uint8x8_t op = vdup_n_u8(opacity);
+        const uint8x8_t val = vdup_n_u8(value);
+        size_t x = 0;
+        for (; x + 8 <= width; x += 8, dst += 8, mask += 8) {
+            const uint8x8_t m = vld1_u8(mask);
+            if (vget_lane_u64(vreinterpret_u64_u8(m), 0) == 0) {
+                continue;
+            }
+            const uint8x8_t a = div255Neon(vmull_u8(m, op));
+            uint16x8_t t = vmull_u8(val, a);
+            t = vmlal_u8(t, vld1_u8(dst), vmvn_u8(a));
+            vst1_u8(dst, div255Neon(t));
+        }
+        blendMaskRowC(dst, mask, width - x, value, opacity);
+    }
+
+    // 8 pixels per iteration, each plane is computed in 32 bits and narrowed like the C version
+    static void blendPremultipliedRowToPlaneNeon(uint8_t *dst, const uint8_t *src, size_t width,
+                                                 const int *c) {
+        const uint8x8_t offset = vdup_n_u8((uint8_t) c[3]);
+        const int32x4_t round = vdupq_n_s32(128);
+        size_t x = 0;
+        for (; x + 8 <= width; x += 8, dst += 8, src += 32) {
+            const uint8x8x4_t p = vld4_u8(src);
+            if (vget_lane_u64(vreinterpret_u64_u8(p.val[3]), 0) == 0) {
+                continue;
+            }
+            const int16x8_t r = vreinterpretq_s16_u16(vmovl_u8(p.val[0]));
+            const int16x8_t g = vreinterpretq_s16_u16(vmovl_u8(p.val[1]));
+            const int16x8_t b = vreinterpretq_s16_u16(vmovl_u8(p.val[2]));
+            int32x4_t lo = vmull_n_s16(vget_low_s16(r), (int16_t) c[0]);
+            lo = vmlal_n_s16(lo, vget_low_s16(g), (int16_t) c[1]);
+            lo = vmlal_n_s16(lo, vget_low_s16(b), (int16_t) c[2]);
+            int32x4_t hi = vmull_n_s16(vget_high_s16(r), (int16_t) c[0]);
+            hi = vmlal_n_s16(hi, vget_high_s16(g), (int16_t) c[1]);
+            hi = vmlal_n_s16(hi, vget_high_s16(b), (int16_t) c[2]);
+            int16x8_t v = vcombine_s16(vshrn_n_s32(vaddq_s32(lo, round), 8),
+                                       vshrn_n_s32(vaddq_s32(hi, round), 8));
+            v = vaddq_s16(v, vreinterpretq_s16_u16(
+                    vmovl_u8(div255Neon(vmull_u8(p.val[3], offset)))));
+            v = vaddq_s16(v, vreinterpretq_s16_u16(
+                    vmovl_u8(div255Neon(vmull_u8(vld1_u8(dst), vmvn_u8(p.val[3]))))));
+            vst1_u8(dst, vqmovun_s16(v));
+        }
+        blendPremultipliedRowToPlaneC(dst, src, width - x, c);
+    }
+
+    // 8 sums per iteration, pairs of samples are added with a pairwise add
+    static void addCoverageRowNeon(uint16_t *sums, const uint8_t *mask, size_t count,
+                                   uint8_t opacity, int shiftX) {
+        const uint8x8_t op = vdup_n_u8(opacity);
+        size_t i = 0;
+        if (shiftX == 1) {
+            for (; i + 8 <= count; i += 8, sums += 8, mask += 16) {
+                const uint8x16_t m = vld1q_u8(mask);
+                const uint8x16_t s = vcombine_u8(div255Neon(vmull_u8(vget_low_u8(m), op)),
+                                                 div255Neon(vmull_u8(vget_high_u8(m), op)));
+                vst1q_u16(sums, vpadalq_u8(vld1q_u16(sums), s));
+            }
+        } else {
+            for (; i + 8 <= count; i += 8, sums += 8, mask += 8) {
+                vst1q_u16(sums, vaddw_u8(vld1q_u16(sums),
+                                         div255Neon(vmull_u8(vld1_u8(mask), op))));
+            }
+        }
+        addCoverageRowC(sums, mask, count - i, opacity, shiftX);
+    }
+
+    // 8 pixels per iteration, channels are deinterleaved on load and interleaved on store
+    static void addPixelRowNeon(uint16_t *sums, const uint8_t *src, size_t count, int shiftX) {
+        size_t i = 0;
+        if (shiftX == 1) {
+            for (; i + 4 <= count; i += 4, sums += 16, src += 32) {
+                const uint8x8x4_t p = vld4_u8(src);
+                uint16x4x4_t s = vld4_u16(sums);
+                for (int c = 0; c < 4; c++) {
+                    s.val[c] = vpadal_u8(s.val[c], p.val[c]);
+                }
+                vst4_u16(sums, s);
+            }
+        } else {
+            for (; i + 8 <= count; i += 8, sums += 32, src += 32) {
+                const uint8x8x4_t p = vld4_u8(src);
+                uint16x8x4_t s = vld4q_u16(sums);
+                for (int c = 0; c < 4; c++) {
+                    s.val[c] = vaddw_u8(s.val[c], p.val[c]);
+                }
+                vst4q_u16(sums, s);
+            }
+        }
+        addPixelRowC(sums, src, count - i, shiftX);
+    }
+
+    // 8 pixels per iteration, channels are deinterleaved on load
+    static void blendRowNeon(uint8_t *dst, const uint8_t *src, size_t width) {
+        size_t x = 0;
+        for (; x + 8 <= width; x += 8, dst += 32, src += 32) {
+            const uint8x8x4_t s = vld4_u8(src);
+
+            // Skip fully transparent spans, copy fully opaque spans
+            const uint64_t alphas = vget_lane_u64(vreinterpret_u64_u8(s.val[3]), 0);
+            if (alphas == 0) {
+                continue;
+            } else if (alphas == UINT64_MAX) {
+                vst4_u8(dst, s);
+                continue;
+            }
+
+            uint8x8x4_t d = vld4_u8(dst);
+            const uint8x8_t ia = vmvn_u8(s.val[3]);
+            for (int c = 0; c < 4; c++) {
+                const uint16x8_t m = vmull_u8(d.val[c], ia);
+                d.val[c] = vqadd_u8(s.val[c], vraddhn_u16(m, vrshrq_n_u16(m, 8)));
+            }
+            vst4_u8(dst, d);
+        }
+        blendRowC(dst, src, width - x);
+    }
+
+#elif defined(BLEND_SSE2)
+
+    static inline __m128i div255SSE2(__m128i x) {
+        x = _mm_add_epi16(x, _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+
+    static inline __m128i blendMaskHalfSSE2(__m128i m, __m128i d, __m128i op, __m128i val) {
+        const __m128i a = div255SSE2(_mm_mullo_epi16(m, op));
+        const __m128i ia = _mm_sub_epi16(_mm_set1_epi16(0xff), a);
+        return div255SSE2(_mm_add_epi16(_mm_mullo_epi16(val, a), _mm_mullo_epi16(d, ia)));
+    }
+
+    // 16 samples per iteration
+    static void blendMaskRowSSE2(uint8_t *dst, const uint8_t *mask, size_t width, uint8_t value,
+                                 uint8_t opacity) {
+        const __m128i zeros = _mm_setzero_si128();
+        const __m128i op = _mm_set1_epi16(opacity);
+        const __m128i val = _mm_set1_epi16(value);
+        size_t x = 0;
+        for (; x + 16 <= width; x += 16, dst += 16, mask += 16) {
+            const __m128i m = _mm_loadu_si128((const __m128i *) mask);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(m, zeros)) == 0xffff) {
+                continue;
+            }
+            const __m128i d = _mm_loadu_si128((const __m128i *) dst);
+            const __m128i lo = blendMaskHalfSSE2(_mm_unpacklo_epi8(m, zeros),
+                                                 _mm_unpacklo_epi8(d, zeros), op, val);
+            const __m128i hi = blendMaskHalfSSE2(_mm_unpackhi_epi8(m, zeros),
+                                                 _mm_unpackhi_epi8(d, zeros), op, val);
+            _mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(lo, hi));
+        }
+        blendMaskRowC(dst, mask, width - x, value, opacity);
+    }
+
+    // Coefficients of two 16 bit values multiplied and added into 32 bits by _mm_madd_epi16
+    static inline __m128i coefficientPairSSE2(int low, int high) {
+        return _mm_set1_epi32((int) ((uint16_t) low | ((uint32_t) (uint16_t) high << 16)));
+    }
+
+    // 8 pixels per iteration, each plane is computed in 32 bits and narrowed like the C version
+    static void blendPremultipliedRowToPlaneSSE2(uint8_t *dst, const uint8_t *src, size_t width,
+                                                 const int *c) {
+        const __m128i zeros = _mm_setzero_si128();
+        const __m128i ones = _mm_set1_epi16(1);
+        const __m128i full = _mm_set1_epi16(0xff);
+        const __m128i byteMask = _mm_set1_epi32(0xff);
+        const __m128i coefRG = coefficientPairSSE2(c[0], c[1]);
+        const __m128i coefB = coefficientPairSSE2(c[2], 128);
+        const __m128i offset = _mm_set1_epi16((short) c[3]);
+        size_t x = 0;
+        for (; x + 8 <= width; x += 8, dst += 8, src += 32) {
+            const __m128i p0 = _mm_loadu_si128((const __m128i *) src);
+            const __m128i p1 = _mm_loadu_si128((const __m128i *) (src + 16));
+            const __m128i a = _mm_packs_epi32(_mm_srli_epi32(p0, ALPHA_SHIFT),
+                                              _mm_srli_epi32(p1, ALPHA_SHIFT));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(a, zeros)) == 0xffff) {
+                continue;
+            }
+            const __m128i r = _mm_packs_epi32(_mm_and_si128(p0, byteMask),
+                                              _mm_and_si128(p1, byteMask));
+            const __m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), byteMask),
+                                              _mm_and_si128(_mm_srli_epi32(p1, 8), byteMask));
+            const __m128i b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), byteMask),
+                                              _mm_and_si128(_mm_srli_epi32(p1, 16), byteMask));
+            const __m128i lo = _mm_srai_epi32(
+                    _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), coefRG),
+                                  _mm_madd_epi16(_mm_unpacklo_epi16(b, ones), coefB)), 8);
+            const __m128i hi = _mm_srai_epi32(
+                    _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), coefRG),
+                                  _mm_madd_epi16(_mm_unpackhi_epi16(b, ones), coefB)), 8);
+            __m128i v = _mm_packs_epi32(lo, hi);
+            v = _mm_add_epi16(v, div255SSE2(_mm_mullo_epi16(a, offset)));
+            const __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) dst), zeros);
+            v = _mm_add_epi16(v, div255SSE2(_mm_mullo_epi16(d, _mm_sub_epi16(full, a))));
+            _mm_storel_epi64((__m128i *) dst, _mm_packus_epi16(v, v));
+        }
+        blendPremultipliedRowToPlaneC(dst, src, width - x, c);
+    }
+
+    // 8 sums per iteration, pairs of samples are added as the halves of 32 bit lanes
+    static void addCoverageRowSSE2(uint16_t *sums, const uint8_t *mask, size_t count,
+                                   uint8_t opacity, int shiftX) {
+        const __m128i zeros = _mm_setzero_si128();
+        const __m128i op = _mm_set1_epi16(opacity);
+        size_t i = 0;
+        if (shiftX == 1) {
+            const __m128i lowHalf = _mm_set1_epi32(0xffff);
+            for (; i + 8 <= count; i += 8, sums += 8, mask += 16) {
+                const __m128i m = _mm_loadu_si128((const __m128i *) mask);
+                const __m128i lo = div255SSE2(_mm_mullo_epi16(_mm_unpacklo_epi8(m, zeros), op));
+                const __m128i hi = div255SSE2(_mm_mullo_epi16(_mm_unpackhi_epi8(m, zeros), op));
+                const __m128i pairs = _mm_packs_epi32(
+                        _mm_add_epi32(_mm_and_si128(lo, lowHalf), _mm_srli_epi32(lo, 16)),
+                        _mm_add_epi32(_mm_and_si128(hi, lowHalf), _mm_srli_epi32(hi, 16)));
+                const __m128i s = _mm_loadu_si128((const __m128i *) sums);
+                _mm_storeu_si128((__m128i *) sums, _mm_add_epi16(s, pairs));
+            }
+        } else {
+            for (; i + 8 <= count; i += 8, sums += 8, mask += 8) {
+                const __m128i m = _mm_loadl_epi64((const __m128i *) mask);
+                const __m128i v = div255SSE2(_mm_mullo_epi16(_mm_unpacklo_epi8(m, zeros), op));
+                const __m128i s = _mm_loadu_si128((const __m128i *) sums);
+                _mm_storeu_si128((__m128i *) sums, _mm_add_epi16(s, v));
+            }
+        }
+        addCoverageRowC(sums, mask, count - i, opacity, shiftX);
+    }
+
+    // 4 pixels per iteration, a pixel is 4 channels of 16 bits after unpacking
+    static void addPixelRowSSE2(uint16_t *sums, const uint8_t *src, size_t count, int shiftX) {
+        const __m128i zeros = _mm_setzero_si128();
+        size_t i = 0;
+        if (shiftX == 1) {
+            for (; i + 2 <= count; i += 2, sums += 8, src += 16) {
+                const __m128i p = _mm_loadu_si128((const __m128i *) src);
+                __m128i lo = _mm_unpacklo_epi8(p, zeros);
+                __m128i hi = _mm_unpackhi_epi8(p, zeros);
+                lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+                hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+                const __m128i s = _mm_loadu_si128((const __m128i *) sums);
+                _mm_storeu_si128((__m128i *) sums,
+                                 _mm_add_epi16(s, _mm_unpacklo_epi64(lo, hi)));
+            }
+        } else {
+            for (; i + 4 <= count; i += 4, sums += 16, src += 16) {
+                const __m128i p = _mm_loadu_si128((const __m128i *) src);
+                const __m128i s0 = _mm_loadu_si128((const __m128i *) sums);
+                const __m128i s1 = _mm_loadu_si128((const __m128i *) (sums + 8));
+                _mm_storeu_si128((__m128i *) sums, _mm_add_epi16(s0, _mm_unpacklo_epi8(p, zeros)));
+                _mm_storeu_si128((__m128i *) (sums + 8),
+                                 _mm_add_epi16(s1, _mm_unpackhi_epi8(p, zeros)));
+            }
+        }
+        addPixelRowC(sums, src, count - i, shiftX);
+    }
+
+    static inline __m128i blendHalfSSE2(__m128i s, __m128i d) {
+        const __m128i ones = _mm_set1_epi16(0xff);
+        const __m128i round = _mm_set1_epi16(128);
+
+        // Spread the alpha of each pixel into all 4 of its 16 bit channels
+        __m128i a = _mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+        __m128i m = _mm_add_epi16(_mm_mullo_epi16(d, _mm_sub_epi16(ones, a)), round);
+        m = _mm_srli_epi16(_mm_add_epi16(m, _mm_srli_epi16(m, 8)), 8);
+        return _mm_add_epi16(s, m);
+    }
+
+    // 4 pixels per iteration
+    static void blendRowSSE2(uint8_t *dst, const uint8_t *src, size_t width) {
+        const __m128i zeros = _mm_setzero_si128();
+        const __m128i opaque = _mm_set1_epi32(0xff);
+        size_t x = 0;
+        for (; x + 4 <= width; x += 4, dst += 16, src += 16) {
+            const __m128i s = _mm_loadu_si128((const __m128i *) src);
+
+            // Skip fully transparent spans, copy fully opaque spans
+            const __m128i alphas = _mm_srli_epi32(s, ALPHA_SHIFT);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(alphas, zeros)) == 0xffff) {
+                continue;
+            } else if (_mm_movemask_epi8(_mm_cmpeq_epi32(alphas, opaque)) == 0xffff) {
+                _mm_storeu_si128((__m128i *) dst, s);
+                continue;
+            }
+
+            const __m128i d = _mm_loadu_si128((const __m128i *) dst);
+            const __m128i lo = blendHalfSSE2(_mm_unpacklo_epi8(s, zeros),
+                                             _mm_unpacklo_epi8(d, zeros));
+            const __m128i hi = blendHalfSSE2(_mm_unpackhi_epi8(s, zeros),
+                                             _mm_unpackhi_epi8(d, zeros));
+            _mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(lo, hi));
+        }
+        blendRowC(dst, src, width - x);
+    }
+
+#if defined(BLEND_AVX2)
+
+    __attribute__((target("avx2")))
+    static inline __m256i blendHalfAVX2(__m256i s, __m256i d) {
+        const __m256i ones = _mm256_set1_epi16(0xff);
+        const __m256i round = _mm256_set1_epi16(128);
+        __m256i a = _mm256_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm256_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+        __m256i m = _mm256_add_epi16(_mm256_mullo_epi16(d, _mm256_sub_epi16(ones, a)), round);
+        m = _mm256_srli_epi16(_mm256_add_epi16(m, _mm256_srli_epi16(m, 8)), 8);
+        return _mm256_add_epi16(s, m);
+    }
+
+    // 8 pixels per iteration, unpack and pack both work within 128 bit lanes so order is kept
+    __attribute__((target("avx2")))
+    static void blendRowAVX2(uint8_t *dst, const uint8_t *src, size_t width) {
+        const __m256i zeros = _mm256_setzero_si256();
+        const __m256i opaque = _mm256_set1_epi32(0xff);
+        size_t x = 0;
+        for (; x + 8 <= width; x += 8, dst += 32, src += 32) {
+            const __m256i s = _mm256_loadu_si256((const __m256i *) src);
+            const __m256i alphas = _mm256_srli_epi32(s, ALPHA_SHIFT);
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(alphas, zeros)) == -1) {
+                continue;
+            } else if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(alphas, opaque)) == -1) {
+                _mm256_storeu_si256((__m256i *) dst, s);
+                continue;
+            }
+
+            const __m256i d = _mm256_loadu_si256((const __m256i *) dst);
+            const __m256i lo = blendHalfAVX2(_mm256_unpacklo_epi8(s, zeros),
+                                             _mm256_unpacklo_epi8(d, zeros));
+            const __m256i hi = blendHalfAVX2(_mm256_unpackhi_epi8(s, zeros),
+                                             _mm256_unpackhi_epi8(d, zeros));
+            _mm256_storeu_si256((__m256i *) dst, _mm256_packus_epi16(lo, hi));
+        }
+        blendRowSSE2(dst, src, width - x);
+    }
+#endif
+
+#endif
+
+    static blend_row_func resolveBlendRowFunc() {
+#if defined(BLEND_NEON)
+        return blendRowNeon;
+#elif defined(BLEND_SSE2)
+#if defined(BLEND_AVX2)
+        if (__builtin_cpu_supports("avx2")) {
+            return blendRowAVX2;
+        }
+#endif
+        return blendRowSSE2;
+#else
+        return blendRowC;
+#endif
+    }
+
+    blend_row_func getBlendRowFunc() {
+        static const blend_row_func func = resolveBlendRowFunc();
+        return func;
+    }
+
+    blend_mask_row_func getBlendMaskRowFunc() {
+#if defined(BLEND_NEON)
+        return blendMaskRowNeon;
+#elif defined(BLEND_SSE2)
+        return blendMaskRowSSE2;
+#else
+        return blendMaskRowC;
+#endif
+    }
+
+    void blendPremultiplied(uint8_t *dst, size_t dstStride, const uint8_t *src, size_t srcStride,
+                            size_t width, size_t height) {
+        const blend_row_func blendRow = getBlendRowFunc();
+        for (size_t y = 0; y < height; y++) {
+            blendRow(dst, src, width);
+            dst += dstStride;
+            src += srcStride;
+        }
+    }
+
+    static inline void blendPremultipliedRowToPlane(uint8_t *dst, const uint8_t *src,
+                                                    size_t width, const int *c) {
+#if defined(BLEND_NEON)
+        blendPremultipliedRowToPlaneNeon(dst, src, width, c);
+#elif defined(BLEND_SSE2)
+        blendPremultipliedRowToPlaneSSE2(dst, src, width, c);
+#else
+        blendPremultipliedRowToPlaneC(dst, src, width, c);
+#endif
+    }
+
+    static inline void addCoverageRow(uint16_t *sums, const uint8_t *mask, size_t count,
+                                      uint8_t opacity, int shiftX) {
+#if defined(BLEND_NEON)
+        addCoverageRowNeon(sums, mask, count, opacity, shiftX);
+#elif defined(BLEND_SSE2)
+        addCoverageRowSSE2(sums, mask, count, opacity, shiftX);
+#else
+        addCoverageRowC(sums, mask, count, opacity, shiftX);
+#endif
+    }
+
+    static inline void addPixelRow(uint16_t *sums, const uint8_t *src, size_t count, int shiftX) {
+#if defined(BLEND_NEON)
+        addPixelRowNeon(sums, src, count, shiftX);
+#elif defined(BLEND_SSE2)
+        addPixelRowSSE2(sums, src, count, shiftX);
+#else
+        addPixelRowC(sums, src, count, shiftX);
+#endif
+    }
+
+    /**
+     * Splits the chroma samples [c0, c0 + count) of a row into the ones whose luma block lies
+     * inside [x, x + width), which go through the row kernels, and the partial ones at the edges
+     */
+    static inline void getFullChromaRange(int x, int width, int shiftX, int c0, int count,
+                                          int *outFirst, int *outEnd) {
+        const int end = c0 + count;
+        *outFirst = std::min(end, std::max(c0, (x + (1 << shiftX) - 1) >> shiftX));
+        *outEnd = std::max(*outFirst, std::min(end, (x + width) >> shiftX));
+    }
+
+    // Adds the coverage of one mask row to the sums of chroma samples [c0, c0 + count)
+    static void addCoverage(uint16_t *sums, const uint8_t *maskRow, int x, int width, int shiftX,
+                            int c0, int count, uint8_t opacity) {
+        int first, end;
+        getFullChromaRange(x, width, shiftX, c0, count, &first, &end);
+        addCoverageRow(sums + first - c0, maskRow + (first << shiftX) - x, (size_t) (end - first),
+                       opacity, shiftX);
+        // Samples at the edges only span part of their luma block
+        const int edges[2][2] = {{c0, first}, {end, c0 + count}};
+        for (const auto &edge : edges) {
+            for (int i = edge[0]; i < edge[1]; i++) {
+                const int colStart = std::max(i << shiftX, x);
+                const int colEnd = std::min((i + 1) << shiftX, x + width);
+                for (int px = colStart; px < colEnd; px++) {
+                    sums[i - c0] += div255((uint32_t) maskRow[px - x] * opacity);
+                }
+            }
+        }
+    }
+
+    // Adds the pixels of one row to the 4 channel sums of chroma samples [c0, c0 + count)
+    static void addPixels(uint16_t *sums, const uint8_t *srcRow, int x, int width, int shiftX,
+                          int c0, int count) {
+        int first, end;
+        getFullChromaRange(x, width, shiftX, c0, count, &first, &end);
+        addPixelRow(sums + (first - c0) * 4, srcRow + ((first << shiftX) - x) * 4,
+                    (size_t) (end - first), shiftX);
+        // Samples at the edges only span part of their luma block
+        const int edges[2][2] = {{c0, first}, {end, c0 + count}};
+        for (const auto &edge : edges) {
+            for (int i = edge[0]; i < edge[1]; i++) {
+                const int colStart = std::max(i << shiftX, x);
+                const int colEnd = std::min((i + 1) << shiftX, x + width);
+                addPixelRowC(sums + (i - c0) * 4, srcRow + (colStart - x) * 4,
+                             (size_t) (colEnd - colStart), 0);
+            }
+        }
+    }
+
+    void blendMaskToYUV(const YUVPlanes &dst, int x, int y, const uint8_t *mask,
+                        size_t maskStride, int width, int height, uint32_t rgba) {
+        if (width <= 0 || height <= 0) {
+            return;
+        }
+        const uint8_t opacity = (uint8_t) (0xff - (rgba & 0xff));
+        if (opacity == 0) {
+            return;
+        }
+        const int (*c)[4] = dst.fullRange ? sFullCoefficients : sLimitedCoefficients;
+        const int r = rgba >> 24, g = (rgba >> 16) & 0xff, b = (rgba >> 8) & 0xff;
+        const uint8_t colorY = clip8(convertComponent(c[0], r, g, b, 0xff));
+        const uint8_t colorU = clip8(convertComponent(c[1], r, g, b, 0xff));
+        const uint8_t colorV = clip8(convertComponent(c[2], r, g, b, 0xff));
+
+        // Luma has the full resolution of the mask
+        const blend_mask_row_func blendRow = getBlendMaskRowFunc();
+        uint8_t *dstY = dst.data[0] + y * dst.linesize[0] + x;
+        for (int j = 0; j < height; j++) {
+            blendRow(dstY + j * dst.linesize[0], mask + j * maskStride, (size_t) width, colorY,
+                     opacity);
+        }
+
+        // Each chroma sample averages the coverage of the luma block it spans, the average is
+        // already scaled by the opacity so the colour is blended with a full opacity
+        const int sx = dst.chromaShiftX, sy = dst.chromaShiftY;
+        const int shift = sx + sy, half = (1 << shift) >> 1;
+        const int cStart = x >> sx, cEnd = ((x + width - 1) >> sx) + 1;
+        uint16_t sums[CHROMA_CHUNK];
+        uint8_t alphas[CHROMA_CHUNK];
+        for (int j = y >> sy; j <= (y + height - 1) >> sy; j++) {
+            const int rowStart = std::max(j << sy, y), rowEnd = std::min((j + 1) << sy, y + height);
+            uint8_t *dstU = dst.data[1] + j * dst.linesize[1];
+            uint8_t *dstV = dst.data[2] + j * dst.linesize[2];
+            for (int c0 = cStart; c0 < cEnd; c0 += CHROMA_CHUNK) {
+                const int count = std::min(CHROMA_CHUNK, cEnd - c0);
+                memset(sums, 0, count * sizeof(uint16_t));
+                for (int py = rowStart; py < rowEnd; py++) {
+                    addCoverage(sums, mask + (py - y) * maskStride, x, width, sx, c0, count,
+                                opacity);
+                }
+                for (int i = 0; i < count; i++) {
+                    alphas[i] = (uint8_t) ((sums[i] + half) >> shift);
+                }
+                blendRow(dstU + c0, alphas, (size_t) count, colorU, 0xff);
+                blendRow(dstV + c0, alphas, (size_t) count, colorV, 0xff);
+            }
+        }
+    }
+
+    void blendPremultipliedToYUV(const YUVPlanes &dst, int x, int y, const uint8_t *src,
+                                 size_t srcStride, int width, int height) {
+        if (width <= 0 || height <= 0) {
+            return;
+        }
+        const int (*c)[4] = dst.fullRange ? sFullCoefficients : sLimitedCoefficients;
+        for (int j = 0; j < height; j++) {
+            blendPremultipliedRowToPlane(dst.data[0] + (y + j) * dst.linesize[0] + x,
+                                         src + j * srcStride, (size_t) width, c[0]);
+        }
+
+        // Each chroma sample converts the average premultiplied pixel of the luma block it spans
+        const int sx = dst.chromaShiftX, sy = dst.chromaShiftY;
+        const int shift = sx + sy, half = (1 << shift) >> 1;
+        const int cStart = x >> sx, cEnd = ((x + width - 1) >> sx) + 1;
+        uint16_t sums[CHROMA_CHUNK * 4];
+        uint8_t pixels[CHROMA_CHUNK * 4];
+        for (int j = y >> sy; j <= (y + height - 1) >> sy; j++) {
+            const int rowStart = std::max(j << sy, y), rowEnd = std::min((j + 1) << sy, y + height);
+            uint8_t *dstU = dst.data[1] + j * dst.linesize[1];
+            uint8_t *dstV = dst.data[2] + j * dst.linesize[2];
+            for (int c0 = cStart; c0 < cEnd; c0 += CHROMA_CHUNK) {
+                const int count = std::min(CHROMA_CHUNK, cEnd - c0);
+                memset(sums, 0, count * 4 * sizeof(uint16_t));
+                for (int py = rowStart; py < rowEnd; py++) {
+                    addPixels(sums, src + (py - y) * srcStride, x, width, sx, c0, count);
+                }
+                for (int i = 0; i < count * 4; i++) {
+                    pixels[i] = (uint8_t) ((sums[i] + half) >> shift);
+                }
+                blendPremultipliedRowToPlane(dstU + c0, pixels, (size_t) count, c[1]);
+                blendPremultipliedRowToPlane(dstV + c0, pixels, (size_t) count, c[2]);
+            }
+        }
+    }
+}
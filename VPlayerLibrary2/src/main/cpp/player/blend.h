@@ -0,0 +1,60 @@
+#ifndef __BLEND_H__
+#define __BLEND_H__
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Alpha compositing of 4 byte pixels with alpha as the last byte (RGBA/BGRA). The channel order
+ * does not matter as long as source and destination share it.
+ * Sources are premultiplied once when the subtitle is prepared, blending per video frame is then
+ * dst = src + dst * (255 - srcAlpha) / 255 for every channel, including alpha.
+ */
+namespace alphablend {
+    typedef void (*blend_row_func)(uint8_t *dst, const uint8_t *src, size_t width);
+    typedef void (*blend_mask_row_func)(uint8_t *dst, const uint8_t *mask, size_t width,
+                                        uint8_t value, uint8_t opacity);
+
+    // Planes of an 8 bit planar yuv frame, colours are converted with BT.601 like swscale does
+    struct YUVPlanes {
+        uint8_t *data[3];
+        size_t linesize[3];
+        int chromaShiftX;
+        int chromaShiftY;
+        bool fullRange;
+    };
+
+    // Premultiply the colour channels by alpha in place
+    void premultiply(uint8_t *data, size_t stride, size_t width, size_t height);
+
+    // Blends premultiplied src over dst with the fastest kernel supported by this cpu
+    void blendPremultiplied(uint8_t *dst, size_t dstStride, const uint8_t *src, size_t srcStride,
+                            size_t width, size_t height);
+
+    // Scalar reference, SIMD kernels produce the exact same output
+    void blendRowC(uint8_t *dst, const uint8_t *src, size_t width);
+
+    // Kernel picked at runtime for this cpu
+    blend_row_func getBlendRowFunc();
+
+    /**
+     * Blends a single colour coverage mask (libass image) into the yuv planes, chroma takes the
+     * average coverage of the luma samples it spans
+     * @param rgba colour as 0xRRGGBBAA where AA is the transparency like libass
+     */
+    void blendMaskToYUV(const YUVPlanes &dst, int x, int y, const uint8_t *mask,
+                        size_t maskStride, int width, int height, uint32_t rgba);
+
+    // Blends a premultiplied RGBA image into the yuv planes, chroma converts the average pixel
+    // of the luma samples it spans
+    void blendPremultipliedToYUV(const YUVPlanes &dst, int x, int y, const uint8_t *src,
+                                 size_t srcStride, int width, int height);
+
+    // dst = (value * a + dst * (255 - a)) / 255 with a = mask * opacity / 255
+    void blendMaskRowC(uint8_t *dst, const uint8_t *mask, size_t width, uint8_t value,
+                       uint8_t opacity);
+
+    blend_mask_row_func getBlendMaskRowFunc();
+}
+
+#endif // __BLEND_H__
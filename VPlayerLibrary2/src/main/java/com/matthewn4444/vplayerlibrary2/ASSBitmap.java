@@ -10,24 +10,46 @@ import java.nio.ByteBuffer;
 
 public class ASSBitmap {
     public final Rect rect = new Rect();
+
+    // Copy of the pixels when direct buffers are disabled
     public final byte[] data;
+
+    // Direct buffer to native memory when direct buffers are enabled, only valid until the next
+    // image is requested from the renderer
+    public final ByteBuffer buffer;
     public final int stride;
+
+    // False if the pixels are the same as the last frame, the rect may have still moved
     public final boolean changed;
 
     ASSBitmap(int x, int y, int r, int b, @Nullable byte[] data, boolean changed, int stride) {
         this.data = data;
+        this.buffer = null;
+        this.stride = stride;
+        this.changed = changed;
+        rect.set(x, y, r, b);
+    }
+
+    ASSBitmap(int x, int y, int r, int b, @Nullable ByteBuffer buffer, boolean changed,
+              int stride) {
+        this.data = null;
+        this.buffer = buffer;
         this.stride = stride;
         this.changed = changed;
         rect.set(x, y, r, b);
     }
 
     public @Nullable Bitmap createBitmap() {
-        if (data == null) {
+        if (data == null && buffer == null) {
             return null;
         }
         Bitmap b = Bitmap.createBitmap(rect.width(), rect.height(), Bitmap.Config.ARGB_8888);
-        ByteBuffer buffer = ByteBuffer.wrap(data);
-        b.copyPixelsFromBuffer(buffer);
+        if (data != null) {
+            b.copyPixelsFromBuffer(ByteBuffer.wrap(data));
+        } else {
+            // Native buffer is reused, do not move its position
+            b.copyPixelsFromBuffer(buffer.duplicate());
+        }
         return b;
     }
 
@@ -25,6 +25,9 @@ public class ASSRenderer {
     @SuppressWarnings("unused") // Constant for JNI renderer pointer
     private long mRendererInstance;
 
+    @SuppressWarnings("unused") // Constant for JNI direct buffer pool pointer
+    private long mBufferPoolInstance;
+
     private final List<ASSTrack> mTracks = new ArrayList<>();
 
     public ASSRenderer() {
@@ -62,14 +65,31 @@ public class ASSRenderer {
         return nativeGetImage(timeMs, track.getInstance());
     }
 
+    /**
+     * Return bitmaps as direct buffers to native memory instead of copying them into new arrays
+     * each frame. The buffers of a frame are only valid until the next call to getImage().
+     * @param enabled use direct buffers
+     */
+    public synchronized void setDirectBuffersEnabled(boolean enabled) {
+        nativeSetDirectBuffers(enabled);
+    }
+
     public native void addFont(String name, byte[] fontData);
 
     public native void setDefaultFont(String fontPath, String fontFamilyName);
 
     public native void setSize(int width, int height);
 
+    /**
+     * Memory libass keeps for glyph outlines and rendered bitmaps
+     * @param megabytes cache size, 0 for the libass defaults
+     */
+    public native void setCacheBudget(int megabytes);
+
     private native void nativeRelease();
 
+    private native void nativeSetDirectBuffers(boolean enabled);
+
     private static native void nativeInit();
 
     private native boolean initRenderer();
@@ -50,6 +50,10 @@ public class VPlayer2NativeController {
     private static final boolean AT_LEAST_N = Build.VERSION.SDK_INT >= Build.VERSION_CODES.N;
     private static final long SEND_SUBTITLE_FRAME_SIZE_TIMEOUT = 300;
 
+    // AudioFormat.ENCODING_PCM_32BIT, added in Android 12
+    private static final int ENCODING_PCM_32BIT = 22;
+    private static final int SDK_ENCODING_PCM_32BIT = 31;
+
     static {
         System.loadLibrary("ffmpeg");
         System.loadLibrary("application");
@@ -241,16 +245,21 @@ public class VPlayer2NativeController {
         }
     }
 
-    private AudioTrack nativeCreateAudioTrack(int sampleRateHz, int numOfChannels) {
+    private AudioTrack nativeCreateAudioTrack(int sampleRateHz, int numOfChannels, int encoding) {
         if (AT_LEAST_N && mAudioTrack != null) {
             mAudioTrack.removeOnRoutingChangedListener(mRoutingChangedListener);
         }
+        if (encoding == ENCODING_PCM_32BIT && Build.VERSION.SDK_INT < SDK_ENCODING_PCM_32BIT) {
+            encoding = AudioFormat.ENCODING_PCM_FLOAT;
+        }
         for (;;) {
-            int channelConfig = numOfChannels < sAudioChannels.length
+            // Compressed audio carries its own channels, the track only needs a valid mask
+            int channelConfig = isCompressedEncoding(encoding) ? AudioFormat.CHANNEL_OUT_STEREO
+                    : numOfChannels < sAudioChannels.length
                     ? sAudioChannels[numOfChannels] : AudioFormat.CHANNEL_OUT_STEREO;
             try {
                 int minBufferSize = AudioTrack.getMinBufferSize(sampleRateHz,
-                        channelConfig, AudioFormat.ENCODING_PCM_16BIT);
+                        channelConfig, encoding);
                 mAudioTrack = new AudioTrack(
                         new AudioAttributes.Builder()
                                 .setUsage(AudioAttributes.USAGE_MEDIA)
@@ -259,7 +268,7 @@ public class VPlayer2NativeController {
                         new AudioFormat.Builder()
                                 .setSampleRate(sampleRateHz)
                                 .setChannelMask(channelConfig)
-                                .setEncoding(AudioFormat.ENCODING_PCM_16BIT)
+                                .setEncoding(encoding)
                                 .build(),
                         minBufferSize, AudioTrack.MODE_STREAM,
                         AudioManager.AUDIO_SESSION_ID_GENERATE);
@@ -268,8 +277,12 @@ public class VPlayer2NativeController {
                 }
                 return mAudioTrack;
             } catch (IllegalArgumentException e) {
-                // Back off number of channels if failed
-                if (numOfChannels > 2) {
+                // Fall back to more common encodings first, then back off number of channels
+                if (encoding == ENCODING_PCM_32BIT) {
+                    encoding = AudioFormat.ENCODING_PCM_FLOAT;
+                } else if (encoding != AudioFormat.ENCODING_PCM_16BIT) {
+                    encoding = AudioFormat.ENCODING_PCM_16BIT;
+                } else if (numOfChannels > 2) {
                     numOfChannels = 2;
                 } else if (numOfChannels > 1) {
                     numOfChannels = 1;
@@ -280,6 +293,11 @@ public class VPlayer2NativeController {
         }
     }
 
+    private static boolean isCompressedEncoding(int encoding) {
+        return encoding == AudioFormat.ENCODING_AC3 || encoding == AudioFormat.ENCODING_E_AC3
+                || encoding == AudioFormat.ENCODING_DTS || encoding == AudioFormat.ENCODING_DTS_HD;
+    }
+
     /**
      *  TODO support multiple screen sizes, wide, aspect etc for surface view resizing
      // Determine the video and width of the video
@@ -310,6 +328,16 @@ public class VPlayer2NativeController {
 
     native void nativeSetDefaultSubtitleFont(String fontPath, String fontFamily);
 
+    native void nativeSetBlendSubtitlesInYUV(boolean flag);
+
+    native void nativeSetSubtitleCacheBudget(int megabytes);
+
+    native void nativeSetPlaybackSpeed(float speed);
+
+    native void nativeSetAudioResampleQuality(int quality);
+
+    native void nativeSetAudioPassthrough(boolean flag);
+
     native void nativeRenderLastFrame();
 
     native void remeasureAudioLatency();
@@ -28,6 +28,14 @@ public class VPlayerView extends FrameLayout {
     public static final int AVMEDIA_TYPE_AUDIO = 1;
     public static final int AVMEDIA_TYPE_SUBTITLE = 2;
 
+    @Retention(RetentionPolicy.SOURCE)
+    @IntDef({AUDIO_RESAMPLE_QUALITY_FAST, AUDIO_RESAMPLE_QUALITY_DEFAULT,
+            AUDIO_RESAMPLE_QUALITY_HIGH})
+    public @interface AudioResampleQuality {}
+    public static final int AUDIO_RESAMPLE_QUALITY_FAST = 0;
+    public static final int AUDIO_RESAMPLE_QUALITY_DEFAULT = 1;
+    public static final int AUDIO_RESAMPLE_QUALITY_HIGH = 2;
+
     private final SurfaceHolder.Callback mSurfaceCallback = new SurfaceHolder.Callback() {
 
         @Override
@@ -165,6 +173,51 @@ public class VPlayerView extends FrameLayout {
         }
     }
 
+    /**
+     * When subtitles are drawn into the video, blend them into the decoded yuv frame before it is
+     * converted to rgba. Faster, but subtitle colours have the chroma resolution of the video.
+     * @param flag blend in yuv
+     */
+    public void setBlendSubtitlesInYUV(boolean flag) {
+        mController.nativeSetBlendSubtitlesInYUV(flag);
+    }
+
+    /**
+     * Memory subtitles can keep for rendered glyphs and images. Raise it for heavily typeset
+     * subtitles that would otherwise be rasterised again every frame.
+     * @param megabytes cache size, 0 for the default
+     */
+    public void setSubtitleCacheBudget(int megabytes) {
+        mController.nativeSetSubtitleCacheBudget(megabytes);
+    }
+
+    /**
+     * Play faster or slower, audio keeps its pitch. Decoding quality is lowered from 1.5x so
+     * high resolution video keeps up. Has no effect on live streams.
+     * @param speed from 0.25 to 4, 1 for normal speed
+     */
+    public void setPlaybackSpeed(float speed) {
+        mController.nativeSetPlaybackSpeed(speed);
+    }
+
+    /**
+     * Quality of the filter used when audio has to be resampled to the output rate or to keep in
+     * sync with the video. Lower it on slow devices.
+     * @param quality one of the AUDIO_RESAMPLE_QUALITY constants
+     */
+    public void setAudioResampleQuality(@AudioResampleQuality int quality) {
+        mController.nativeSetAudioResampleQuality(quality);
+    }
+
+    /**
+     * Send AC3, EAC3 and DTS audio undecoded to sinks that take it, such as HDMI receivers. Volume
+     * and playback speed do not apply to it. Used from the next video opened.
+     * @param flag pass compressed audio through
+     */
+    public void setAudioPassthrough(boolean flag) {
+        mController.nativeSetAudioPassthrough(flag);
+    }
+
     @Override
     protected void onDetachedFromWindow() {
         mController.onDestroy();
@@ -700,7 +700,12 @@ EOF
     make -j${JOBS}
     make -j${JOBS} install || exit 1
     cd ..
-    LINKER_LIBS="$LINKER_LIBS -lavcodec -lavformat -lavutil -lswresample -lswscale"
+    LINKER_LIBS="$LINKER_LIBS -lavcodec -lavformat -lavfilter -lavutil -lswresample -lswscale"
+
+    # Filters built with --enable-gpl need postproc
+    if [ -f "$PREFIX/lib/libpostproc.a" ]; then
+        LINKER_LIBS="$LINKER_LIBS -lpostproc"
+    fi
 }
 
 function build_one {